@@ -1 +1 @@
-gcc main.c cJSON.c -o main -lcurl -lncurses -lmenu -lpanel -luuid -lform
+gcc main.c cJSON.c -o main -lcurl -lncursesw -lmenuw -lpanelw -luuid -pthread
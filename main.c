@@ -1,27 +1,107 @@
 // Ncurses work is at the very least partial courtesy of Pradeep Padala:
 // https://tldp.org/HOWTO/NCURSES-Programming-HOWTO/index.html
 
+// For wcwidth
+#define _GNU_SOURCE
+
 #include <cdk.h>
 #include <cdk/dialog.h>
 #include <cjson/cJSON.h>
+#include <ctype.h>
 #include <curl/curl.h>
 #include <curl/easy.h>
 #include <curses.h>
-#include <form.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <locale.h>
 #include <menu.h>
 #include <ncurses.h>
 #include <panel.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <time.h>
 #include <unistd.h>
 #include <uuid/uuid.h>
+#include <wchar.h>
 
 #define BASE_REST_URL "https://api.todoist.com/rest/v2/"
 #define BASE_SYNC_URL "https://api.todoist.com/sync/v9/sync"
+#define FILTER_VIEW_ID_PREFIX "filter:"
+#define NO_DUE_DAY INT_MIN
 #define NO_TASKS_TO_COMPLETE_MESSAGE                                           \
   "No tasks left to complete! Have a good day!"
+#define NO_MATCHING_TASKS_MESSAGE "No tasks match your search."
+// Rows cached on top of what fits on screen, so scrolling back and forth a
+// little doesn't format them again
+#define LIST_ROW_MARGIN 16
+// How long a notice stays on the status line
+#define NOTICE_MS 4000
+// Frames are at least this far apart, however fast keys come in
+#define FRAME_MS 16
+// How much memory views left open for later can take, unless
+// TODOIST_VIEW_CACHE_MB says otherwise
+#define VIEW_CACHE_MB 64
+// Terminals with bracketed paste wrap what's pasted in these, which define_key
+// turns into keys of their own
+#define KEY_PASTE_START (KEY_MAX + 1)
+#define KEY_PASTE_END (KEY_MAX + 2)
+// Tasks per sync request when several are created at once. Todoist takes up to
+// 100 commands in one.
+#define CREATE_BATCH 100
+// Slots in each ring between the UI and network threads, which is also how
+// many requests can be in flight at once. Has to be a power of two.
+#define NETWORK_RING_SIZE 256
+// Most worker threads the pool starts, however many cores there are
+#define MAX_WORKERS 16
+// Top-level arrays at least this big are parsed in chunks across the workers,
+// in about this many chunks per worker, each at least PARSE_CHUNK_BYTES
+#define PARALLEL_PARSE_BYTES (1024 * 1024)
+#define PARSE_CHUNKS_PER_WORKER 4
+#define PARSE_CHUNK_BYTES (256 * 1024)
+// The background refresh runs about every REFRESH_MS while someone's pressed a
+// key in the last ACTIVE_MS. Otherwise it backs off, doubling every time
+// nothing's changed, up to REFRESH_MAX_MS. Every interval is give or take
+// REFRESH_JITTER percent. REFRESH_RETRY_MS is how soon it tries again when the
+// UI is busy.
+#define REFRESH_MS (30 * 1000)
+#define REFRESH_MAX_MS (15 * 60 * 1000)
+#define ACTIVE_MS (60 * 1000)
+#define REFRESH_JITTER 20
+#define REFRESH_RETRY_MS 2000
+// Transfers shared by every request that isn't REQUEST_INTERACTIVE, which
+// never waits for one
+#define MAX_TRANSFERS 6
+// How long the projects menu's cursor has to stay on a project before its
+// tasks are fetched, ahead of it being opened
+#define PREFETCH_DELAY_MS 300
+// Todoist takes about 1000 requests every 15 minutes, to REST and the Sync API
+// each. A bucket of RATE_BURST refilling at RATE_PER_SECOND never goes over
+// that in any 15 minutes, while a short burst still goes out all at once.
+#define RATE_BURST 100
+#define RATE_PER_SECOND 1.0
+// How long nothing's sent after a 429 that doesn't say
+#define RATE_LIMITED_MS (15 * 1000)
+// A request that fails on the way there, gets a 5xx or is turned away with a
+// 429 is sent again up to RETRY_ATTEMPTS times. After a failure it waits
+// RETRY_MS, doubling every time up to RETRY_MAX_MS, and then somewhere
+// between half of that and all of it, so clients that failed together don't
+// all come back together.
+#define RETRY_ATTEMPTS 5
+#define RETRY_MS 500
+#define RETRY_MAX_MS (8 * 1000)
 
 // Structs
 //
@@ -34,6 +114,15 @@ struct menuTask {
   char *content;
 };
 
+// Text being edited, with the unused space (the gap) kept at the cursor so
+// typing or deleting there never moves the rest of it
+struct gapBuffer {
+  char *text;
+  int gapStart;
+  int gapEnd;
+  int capacity;
+};
+
 // Url args can simply be added to the url itself
 struct curlArgs {
   CURL *curl;
@@ -48,9 +137,722 @@ struct taskMetaData {
   char *content;
   int priority;
 };
+
+// How much has been written to the terminal. A frame is whatever one
+// presentFrame sends.
+struct renderStats {
+  unsigned long long totalBytes;
+  unsigned long long frameBytes;
+  unsigned long frames;
+  // Set with TODOIST_FRAME_STATS, shows frameBytes under the task list
+  int visible;
+};
+
+// Open addressing hash map from strings to ints. Keys are borrowed, so they
+// need to outlive the map (usually they point into cJSON valuestrings).
+struct stringMap {
+  const char **keys;
+  int *values;
+  int capacity;
+  int length;
+};
+
+// A single row in a project's hierarchy. Everything here is an index into
+// taskTree.nodes (-1 meaning "none") so the pool can be realloc()-ed safely.
+// Section headers are nodes too, with no json.
+struct taskNode {
+  cJSON *json;
+  int parent;
+  int firstChild;
+  int lastChild;
+  int prevSibling;
+  int nextSibling;
+  // Rows that aren't hidden by a collapsed ancestor, in pre-order
+  int prevVisible;
+  int nextVisible;
+  int depth;
+  int collapsed;
+  // Whether it's in the visible list
+  int visible;
+  // Index into sectionTable, only for section headers
+  int section;
+};
+
+// Every task containing a gram, by doc id. Doc ids only ever go up (and
+// compacting keeps their order), so these stay sorted just by appending.
+struct postingList {
+  int *docs;
+  int length;
+  int capacity;
+};
+
+struct searchDoc {
+  cJSON *json;
+  // Lowercased content and description. NULL once the task is removed.
+  char *text;
+};
+
+// Inverted index over the content and description of every cached task. Each
+// 1, 2 and 3 byte gram is indexed, so a query of any length starts from a
+// posting list rather than every doc.
+struct searchIndex {
+  struct searchDoc *docs;
+  int docsLength;
+  int docsCapacity;
+  // Open addressing map from a packed gram (+ 1, so 0 is empty) to its
+  // posting list
+  int *grams;
+  int *gramLists;
+  int gramsCapacity;
+  int gramsLength;
+  struct postingList *postings;
+  int postingsLength;
+  int postingsCapacity;
+  // Task id -> doc id
+  struct stringMap ids;
+  // Docs that have been removed but still hold a slot and their place in
+  // the posting lists. Past half of docsLength they're compacted away.
+  int removed;
+  // The last query and its results. If the next query extends it, only these
+  // need to be checked again, which is what makes typing narrow the results.
+  char *lastQuery;
+  int *lastResults;
+  int lastResultsLength;
+};
+
+// Subtasks and sections of a project, built from parent_id and section_id.
+// Removed nodes keep their slot, so indices never change.
+struct taskTree {
+  struct taskNode *nodes;
+  int length;
+  int capacity;
+  int firstRoot;
+  int lastRoot;
+  int firstHeader;
+  int firstVisible;
+  int lastVisible;
+  int visibleLength;
+  // Set while the visible list holds search results instead
+  int filtered;
+  struct stringMap ids;
+};
+
+// A formatted row of the task list. Slots are picked by node, so each one is
+// recycled for whatever node lands in it next.
+struct listRow {
+  int node;
+  char *text;
+};
+
+// What's on screen of a taskTree's visible list. Positions are nodes rather
+// than indices, so rows can come and go anywhere without moving them.
+struct listView {
+  WINDOW *window;
+  // Node on the first row, -1 if the list is empty
+  int top;
+  int cursor;
+  int cursorRow;
+  int height;
+  int width;
+  // height + 2 * LIST_ROW_MARGIN of them, however long the list is. Each text
+  // is already fitted to width columns, in up to rowBytes bytes.
+  struct listRow *rows;
+  int rowsLength;
+  int rowBytes;
+};
+
+// How urgent a request is, most urgent first. A class only gets a transfer
+// once every class before it has all it wants.
+enum requestClass {
+  // Changes the user just made, which never wait behind anything
+  REQUEST_INTERACTIVE,
+  // What's about to be on screen, which the user is waiting for
+  REQUEST_VIEW,
+  // What might be on screen next
+  REQUEST_PREFETCH,
+  // Keeping what's there up to date
+  REQUEST_BACKGROUND,
+  REQUEST_CLASSES,
+};
+
+// Which quota a request counts against
+enum apiBucket {
+  BUCKET_REST,
+  BUCKET_SYNC,
+  BUCKETS,
+};
+
+enum requestState {
+  REQUEST_IDLE,
+  REQUEST_QUEUED,
+  REQUEST_RUNNING,
+  // Failed, and waiting on retryTimer to go back in the queue
+  REQUEST_RETRYING,
+  // Waiting on attachedTo, which someone else started, instead of a transfer
+  // of its own
+  REQUEST_ATTACHED,
+};
+
+// A request started with startRequest. It's found again through
+// CURLOPT_PRIVATE when it finishes, so it has to outlive the request.
+struct pendingRequest {
+  void (*handler)(CURL *curl, CURLcode result, void *data);
+  void *data;
+  enum requestClass class;
+  // Throws away whatever came in before the request was preempted or turned
+  // away, so it can start over. Requests without one are never preempted or
+  // sent again.
+  void (*restart)(void *data);
+  enum apiBucket bucket;
+  CURL *curl;
+  enum requestState state;
+  // Times it's been sent again after failing
+  int attempts;
+  int retryTimer;
+  struct pendingRequest *attachedTo;
+  // Aborted to make room for something more urgent, rather than cancelled
+  int preempted;
+  // Checked by the network thread while it's running, which aborts it
+  atomic_int cancelled;
+  // In its class's queue, or the running list
+  struct pendingRequest *next;
+};
+
+enum mutationType {
+  MUTATION_CLOSE,
+  MUTATION_REOPEN,
+  MUTATION_CREATE,
+  MUTATION_DELETE,
+};
+
+// A change that's already been made on screen while the request making it on
+// the server is in flight. If the request fails, the change is undone.
+struct pendingMutation {
+  enum mutationType type;
+  struct taskView *view;
+  // The task the change starts from. For a new task this is its temp_id until
+  // the server hands out a real one.
+  char *id;
+  // Every task it touches (a deleted task's subtasks go with it). They stay
+  // in view->json until the server has agreed, so undoing is just rebuilding
+  // the tree.
+  cJSON **tasks;
+  int tasksLength;
+  CURL *curl;
+  struct curl_slist *headers;
+  struct memory response;
+  struct pendingRequest request;
+  // What started it, which is done once its last mutation is
+  struct taskAction *action;
+  struct pendingMutation *next;
+};
+
+enum taskActionStep {
+  // Waiting on the user, on the view's status line
+  ACTION_ASKING,
+  // Waiting on the server, for its mutations
+  ACTION_SENDING,
+};
+
+// Creating, closing, reopening or deleting tasks, as a state machine the event
+// loop moves along. A step that has to wait (on a key, or the server) returns
+// to the loop, and the action picks up where it left off once that comes in,
+// so nothing blocks and any number of them can be under way at once. Only one
+// can be asking at a time, since it takes the keys.
+struct taskAction {
+  enum mutationType type;
+  enum taskActionStep step;
+  struct taskView *view;
+  // The task it's about, unless it's creating some. It's found again by id,
+  // since the tree can be rebuilt while it waits.
+  char *id;
+  // The new tasks' names as they're typed, a line each
+  struct gapBuffer input;
+  int pasting;
+  int lines;
+  // Its mutations still in flight
+  int sending;
+  struct taskAction *next;
+};
+
+// A search being typed on a taskView's status line
+struct taskSearch {
+  char query[256];
+  int queryLength;
+  // Set when the query changed since the list was last narrowed to it
+  int changed;
+};
+
+// Everything projectPanel keeps about the project it's showing
+struct taskView {
+  cJSON *json;
+  struct taskTree *tree;
+  struct listView list;
+  // The line under the list, for the search prompt and notices
+  WINDOW *status;
+  struct curlArgs curlArgs;
+  struct pendingMutation *mutations;
+  int pendingMutations;
+  // Every action under way, and the one asking on the status line (if any)
+  struct taskAction *actions;
+  struct taskAction *asking;
+  // The search on the status line, if there is one. Like an action that's
+  // asking, it takes the keys.
+  struct taskSearch *searching;
+  // Clears the notice, or -1
+  int noticeTimer;
+  // j and k presses that haven't moved the cursor yet. They're added up and
+  // applied in one go when the frame is drawn.
+  int pendingMove;
+  // Set when a background refresh brought changes the view couldn't take at
+  // the time. It's not cached once it's left.
+  int stale;
+};
+
+// A project's view, kept after leaving it so coming back doesn't fetch, sort
+// or build anything. It's only good while viewVersion(key) hasn't moved on.
+struct cachedView {
+  char *key;
+  struct taskView *view;
+  size_t bytes;
+  unsigned long version;
+  struct cachedView *prev;
+  struct cachedView *next;
+};
+
+// Views left recently, most recent first. Whatever's last goes once bytes is
+// over budget.
+struct viewCache {
+  struct cachedView *first;
+  struct cachedView *last;
+  int length;
+  size_t bytes;
+  size_t budget;
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long evictions;
+};
+
+// Everything the projects menu's key handler needs
+struct projectsView {
+  MENU *menu;
+  cJSON *json;
+  struct filterView *filterViews;
+  CURL *curl;
+  struct curl_slist *headers;
+  int row;
+  int col;
+  // Goes up whenever a refresh changes the projects
+  unsigned long version;
+};
+
+// A task in the cache, with its due date decoded once so date queries never
+// have to parse strings. Heap allocated so the due index can point at it.
+struct cachedTask {
+  cJSON *json;
+  // Position in taskCache.tasks
+  int slot;
+  // Days since 1970-01-01 (local time), or NO_DUE_DAY
+  int dueDay;
+  // Minutes since local midnight, or -1 for all day tasks
+  int dueMinute;
+  // Bit n is set if the task has label n of labelTable. taskCache.labelWords
+  // long.
+  uint64_t *labels;
+  // Index into sectionTable (or -1), and position in that section's list
+  int section;
+  int sectionSlot;
+};
+
+// Interns strings into small ints, so tasks can refer to labels and sections
+// by number instead of carrying names around.
+struct internTable {
+  // What entries are looked up by: lowercased name for labels, id for sections
+  char **keys;
+  char **names;
+  int length;
+  int capacity;
+  struct stringMap ids;
+};
+
+struct cachedTaskList {
+  struct cachedTask **tasks;
+  int length;
+  int capacity;
+};
+
+// Cached tasks that have a due date, ordered by (dueDay, dueMinute). Today,
+// overdue and upcoming are all contiguous ranges of this.
+struct dueIndex {
+  struct cachedTask **entries;
+  int length;
+  int capacity;
+};
+
+// Every active task in the account, fetched once at startup so filter views
+// can be built without the network. version goes up whenever json changes,
+// and a project's entry in projectVersions whenever one of its tasks does.
+struct taskCache {
+  cJSON *json;
+  struct cachedTask **tasks;
+  int length;
+  int capacity;
+  // id -> slot
+  struct stringMap ids;
+  struct dueIndex due;
+  // Indexed by section, the tasks in each one
+  struct cachedTaskList *sectionTasks;
+  int sectionTasksLength;
+  // Number of 64 bit words in every cached task's label set
+  int labelWords;
+  // What '/' searches, in any view. NULL if it couldn't be built.
+  struct searchIndex *search;
+  unsigned long version;
+  // Interned project ids, and each one's version
+  struct internTable projects;
+  unsigned long *projectVersions;
+  int projectVersionsCapacity;
+  // Set while a refresh applies its changes, and once one of them has
+  // changed something. See cacheBeginChanges.
+  int applying;
+  int applied;
+};
+
+enum filterOp {
+  FILTER_TODAY,
+  FILTER_OVERDUE,
+  FILTER_UPCOMING,
+  FILTER_PRIORITY,
+  FILTER_PROJECT,
+  FILTER_LABEL,
+  FILTER_SECTION,
+  FILTER_AND,
+  FILTER_OR,
+  FILTER_NOT
+};
+
+struct filterInstruction {
+  enum filterOp op;
+  // Priority (Todoist's own value, so p1 is 4), number of days, or a label or
+  // section from their intern tables
+  int number;
+  // Project name
+  char *string;
+  // The id of the project named string, looked up in the live projects before
+  // every run, since they can be renamed or added while the program's kept.
+  // NULL if there's no such project.
+  const char *projectId;
+};
+
+// A filter query compiled to postfix, so evaluating it against a task is one
+// pass over a small array with a stack of booleans.
+struct filterProgram {
+  struct filterInstruction *code;
+  int length;
+  int capacity;
+  int stackDepth;
+  // Whether it compares times of day, not just dates (overdue does)
+  int usesMinute;
+};
+
+// What's on screen registers itself with the event loop through one of these
+struct eventView {
+  void (*onKey)(int key, void *data);
+  // Called after the terminal (and stdscr) has been resized
+  void (*onResize)(void *data);
+  // Puts whatever onKey changed on the terminal, once requestFrame has been
+  // called and the last frame has had time to go out
+  void (*onFrame)(void *data);
+  void *data;
+};
+
+// A file descriptor the event loop watches. eventLoop.sources is indexed by fd.
+struct eventSource {
+  void (*handler)(int fd, unsigned int events, void *data);
+  void *data;
+  unsigned int events;
+};
+
+struct eventTimer {
+  int id;
+  // CLOCK_MONOTONIC milliseconds
+  long long deadline;
+  void (*handler)(void *data);
+  void *data;
+};
+
+// A request on its way to the network thread, or a finished one on its way
+// back
+struct networkMessage {
+  CURL *curl;
+  CURLcode result;
+};
+
+// Carries networkMessages from one thread to one other. Only the producer
+// writes tail and only the consumer writes head, so neither needs a lock. They
+// get a cache line each so the two threads don't fight over it.
+struct messageRing {
+  struct networkMessage slots[NETWORK_RING_SIZE];
+  _Alignas(64) atomic_uint head;
+  _Alignas(64) atomic_uint tail;
+};
+
+// Work for the worker pool. run is called on a worker, then finish (if it
+// isn't NULL) back on the UI thread. A job without finish isn't touched once
+// run returns.
+struct job {
+  void (*run)(void *data);
+  void (*finish)(void *data);
+  void *data;
+  struct job *next;
+  // The counter helpJobs waits on it by, or NULL if nothing does
+  atomic_int *owner;
+};
+
+// One worker's jobs, in a ring. The worker takes the newest from the back of
+// its own, and one that's run out steals the oldest from the front of another.
+struct jobDeque {
+  pthread_mutex_t lock;
+  struct job **jobs;
+  int capacity;
+  int head;
+  int length;
+};
+
+// Threads that take decoding and the like off the UI thread. queued counts
+// jobs in the deques that no worker has claimed yet, and workers sleep on
+// wake while it's 0. helpJobs sleeps on done, which is broadcast whenever
+// a job with an owner has run. Finished jobs are handed to the UI thread
+// through finished, finishedFd (an eventfd) waking the event loop up for them.
+struct workerPool {
+  pthread_t *threads;
+  struct jobDeque *deques;
+  int length;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  pthread_cond_t done;
+  int queued;
+  int stopping;
+  unsigned int nextDeque;
+  pthread_mutex_t finishedLock;
+  struct job *finished;
+  int finishedFd;
+};
+
+// A request answering with JSON, which is parsed (and prepared, if prepare
+// isn't NULL) on the worker pool. *pending is decremented once json is ready,
+// and then finish is called if it isn't NULL.
+struct jsonRequest {
+  CURL *curl;
+  struct memory response;
+  struct pendingRequest request;
+  struct job job;
+  cJSON *(*prepare)(cJSON *json);
+  int *pending;
+  void (*finish)(struct jsonRequest *request);
+  CURLcode result;
+  long httpCode;
+  cJSON *json;
+  // Where parsing stopped, if it failed
+  const char *error;
+  // The GET it's waiting on along with whoever else asked for the same URL
+  struct sharedFetch *fetch;
+  struct jsonRequest *nextWaiter;
+};
+
+// A GET that's fetched and parsed once for every jsonRequest that asks for its
+// URL (with the same prepare) while it's in flight. It has a handle and
+// headers of its own, since whoever started it might not be the one still
+// waiting on it, and is cancelled once nobody is.
+struct sharedFetch {
+  char *url;
+  cJSON *(*prepare)(cJSON *json);
+  CURL *curl;
+  struct curl_slist *headers;
+  struct memory response;
+  struct pendingRequest request;
+  struct job job;
+  CURLcode result;
+  long httpCode;
+  cJSON *json;
+  const char *error;
+  struct jsonRequest *waiters;
+  // Nobody's waiting on it any more, and it's on its way out
+  int abandoned;
+  struct sharedFetch *next;
+};
+
+// The GETs in flight that can still be shared, and handles kept from ones
+// that are done. shared counts the requests that found one to wait on.
+struct fetchTable {
+  struct sharedFetch *fetches;
+  CURL *spare[MAX_TRANSFERS];
+  int spareLength;
+  unsigned long started;
+  unsigned long shared;
+};
+
+// Keeps the projects menu and whichever project is open up to date in the
+// background, through the Sync API's incremental sync. syncToken says what's
+// been seen so far, so each refresh only brings what's changed since.
+struct refresher {
+  char *syncToken;
+  CURL *curl;
+  struct curl_slist *headers;
+  // The body of the refresh in flight, which curl doesn't copy
+  char *body;
+  struct jsonRequest request;
+  int pending;
+  // The next refresh, and when it's due
+  int timer;
+  long long due;
+  long long interval;
+  long long lastActivity;
+  unsigned int seed;
+  struct projectsView *projects;
+  struct taskView *view;
+  char *viewKey;
+};
+
+// Fetches the project the projects menu's cursor rests on into the view cache,
+// so it's likely there by the time it's opened. wantedKey is what the timer's
+// waiting to fetch, and viewKey what was fetched last.
+struct prefetcher {
+  struct curl_slist *headers;
+  struct jsonRequest request;
+  int pending;
+  int timer;
+  char *wantedKey;
+  char *viewKey;
+  char *url;
+  int row;
+  int col;
+};
+
+// A token bucket in front of one of Todoist's quotas. Every request takes a
+// token, and they come back at RATE_PER_SECOND up to RATE_BURST.
+struct rateBucket {
+  double tokens;
+  long long refilled;
+  // Nothing's sent before this, after a 429
+  long long blockedUntil;
+  // Since when something's been waiting for a token, or 0
+  long long waitingSince;
+  long long throttledMs;
+  unsigned long rejected;
+};
+
+// One piece of a top-level array being parsed in parallel. text is a copy of
+// some of its elements, wrapped in brackets of its own.
+struct parseChunk {
+  struct job job;
+  char *text;
+  cJSON *json;
+  atomic_int *pending;
+};
+
+// What performRequest waits on
+struct blockingRequest {
+  int pending;
+  CURLcode result;
+};
+
+// The one loop everything runs in. Keys on the tty, finished requests (through
+// an eventfd), timers (sharing one timerfd) and SIGWINCH (through a signalfd)
+// are all waited on with a single epoll, so nothing runs until one of them is
+// ready. curl itself runs on a thread of its own, so DNS, TLS and transfers
+// never hold up a frame.
+struct eventLoop {
+  int epoll;
+  int timerFd;
+  int signalFd;
+  struct eventSource *sources;
+  int sourcesLength;
+  struct eventTimer *timers;
+  int timersLength;
+  int timersCapacity;
+  int nextTimerId;
+  // Owned by the network thread, along with every request while it's in
+  // flight. Requests go to it through requests, and come back through
+  // completions, networkFd waking this loop up for them.
+  CURLM *multi;
+  pthread_t network;
+  int networkStarted;
+  atomic_int networkStopping;
+  int networkFd;
+  struct messageRing requests;
+  struct messageRing completions;
+  // Started and not handed back yet, which is kept below NETWORK_RING_SIZE so
+  // completions can never fill up
+  int inFlight;
+  // Requests waiting to start, in a queue per class, and the ones that have.
+  // transfers counts the running ones that aren't REQUEST_INTERACTIVE.
+  struct pendingRequest *queued[REQUEST_CLASSES];
+  struct pendingRequest *queuedLast[REQUEST_CLASSES];
+  struct pendingRequest *running;
+  int transfers;
+  // Shared by every request, and the timer dispatching again once one of
+  // them has a token for what's waiting (or -1)
+  struct rateBucket buckets[BUCKETS];
+  int rateTimer;
+  unsigned int retrySeed;
+  unsigned long retries;
+  struct eventView view;
+  // Set by stopEventLoop to make runEventLoop return
+  int stopped;
+  // Above 0 while something waits for a key or a request itself, so keys and
+  // resizes are held back from the view
+  int modal;
+  int keysMuted;
+  int pendingResize;
+  // Keys are read from a pad, since wgetch on a window refreshes it first,
+  // which would draw a frame for every key
+  WINDOW *input;
+  int frameRequested;
+  // When the next frame can be drawn, and the timer waiting for it (or -1)
+  long long nextFrame;
+  int frameTimer;
+};
+
+// A view in the projects menu that's backed by a filter instead of a project.
+// results is memoised until taskCache.version changes.
+struct filterView {
+  char *name;
+  char *query;
+  struct filterProgram *program;
+  cJSON *results;
+  // What results were worked out against: the cache's version, and the local
+  // day and minute, since dates like today move on without the cache changing
+  unsigned long version;
+  unsigned long projectsVersion;
+  int day;
+  int minute;
+  // Goes up every time results are worked out again
+  unsigned long generation;
+};
 //
 // End structs
 
+// Globals
+//
+static struct eventLoop eventLoop;
+static struct renderStats renderStats;
+static struct viewCache viewCache;
+static struct workerPool workerPool;
+static struct refresher refresher;
+static struct prefetcher prefetcher = {.timer = -1};
+static struct fetchTable fetchTable;
+static struct taskCache taskCache;
+static struct internTable labelTable;
+static struct internTable sectionTable;
+// Whether the terminal's been asked to mark pastes, which a signal has to
+// undo on the way out
+static volatile sig_atomic_t bracketedPaste;
+static struct sigaction exitActions[3];
+static const int exitSignals[3] = {SIGHUP, SIGINT, SIGTERM};
+//
+// End globals
+
 // Headers
 //
 
@@ -66,6 +868,16 @@ static size_t curlWriteHelper(char *data, size_t size, size_t nmemb,
 // Clears the ncurses window
 void displayMessage(char *message);
 
+// Sends everything that's been wnoutrefresh()-ed to the terminal, and counts
+// the bytes it took in renderStats. ncurses only sends cells that differ from
+// what's already on screen, as long as nothing forces a full repaint (which
+// is why nothing here uses clear()).
+void presentFrame(void);
+
+// Puts the size of the last frame at the right end of window's first line, if
+// renderStats.visible is set
+void drawFrameStats(WINDOW *window);
+
 // Helper function for making a request. Return value needs to be free()-ed
 cJSON *makeRequest(struct curlArgs curlArgs);
 
@@ -74,41 +886,79 @@ MENU *renderMenuFromJson(cJSON *json, char *query);
 
 // Function for rendering a certain project's tasks. Check out Todoist itself
 // for a little bit more insight on how this is set up.
-void projectPanel(struct curlArgs curlArgs, int row, int col);
+// If localTasks isn't NULL it's shown instead of fetching with curlArgs. The
+// view is cached under viewKey when it's left, and picked up from there the
+// next time.
+void projectPanel(struct curlArgs curlArgs, int row, int col,
+                  cJSON *localTasks, char *viewKey);
+
+// Fetches (or copies localTasks), sorts and builds everything projectPanel
+// shows, in a row by col screen. Returns NULL after telling the user if
+// anything went wrong, or without a word if they backed out of the fetch.
+struct taskView *createTaskView(struct curlArgs curlArgs, int row, int col,
+                                cJSON *localTasks);
+void freeTaskView(struct taskView *view);
+
+// Roughly how much memory a view holds, for the view cache's budget
+size_t taskViewBytes(struct taskView *view);
+
+// Takes the view cached under key out of the cache. Returns NULL if there
+// isn't one, or if it's out of date (in which case it's freed).
+struct taskView *takeCachedView(const char *key);
+
+// Caches view under key as the most recently used, then evicts from the
+// other end until the cache is within its budget. That can be view itself.
+void cacheTaskView(const char *key, struct taskView *view);
+void freeViewCache(void);
 
 // Helper function. Given a menu and a cJSON array, it returns the currently
 // selected item as a cJSON struct. The cJSON array and menu items need to be
 // the same length and in the same order
 cJSON *getCurrentItemJson(MENU *menu, cJSON *json);
 
-// Closes a task, and returns the updated list of items
-ITEM **closeTask(cJSON *tasksJson, MENU *tasksMenu, struct curlArgs curlArgs);
-
-// Helper function. See source.
-void setItemsAndRepostMenu(MENU *menu, ITEM **items);
-
 // Helper function to get the value from a JSON object
 char *getJsonValue(cJSON *json, char *key);
 
-// Similar logic to closeTask. We don't have to return anything, because there's
-// no UI changes to make.
-boolean reopenTask(cJSON *tasksJson, MENU *tasksMenu, struct curlArgs curlArgs);
-
 // Creates a cJSON item that looks like this:
 // https://developer.todoist.com/sync/v9/#due-dates
+// Returns NULL on failure.
 cJSON *createJsonDueCommand(char *string, char *itemId);
 
-// Displays an input field to the user (clears screen). Returns the char *
-// (needs to be free()-ed) to what the user inputted.
-char *displayInputField(char *infoText);
+// Draws the line being edited in buffer on row y of window, scrolled so the
+// cursor is in view, and leaves the window's cursor where the buffer's is.
+// Newlines show up as spaces.
+void drawInputLine(WINDOW *window, int y, struct gapBuffer *buffer);
 
-// Sort array. For those of you who are algorithmically inclined, I am so, so,
-// sorry that you have to see this. This is awful. It's kinda hard to
-// sort in any other way, because cJSON items are basically linked lists.
-cJSON *sortTasks(cJSON *json);
+// Asks the terminal to mark pastes (on) or to stop, through ncurses' putp
+// rather than around it
+void setBracketedPaste(int on);
+
+// Has SIGHUP, SIGINT and SIGTERM turn bracketed paste off before going on to
+// whatever handled them already, which is ncurses' own cleanup after initscr
+void watchExitSignals(void);
+
+// Returns 0 if capacity bytes couldn't be allocated
+int gapBufferInit(struct gapBuffer *buffer, int capacity);
+void gapBufferFree(struct gapBuffer *buffer);
+
+// Inserts length bytes at the cursor, growing the buffer if they don't fit.
+// Returns 0 on failure.
+int gapBufferInsert(struct gapBuffer *buffer, const char *bytes, int length);
+
+// Deletes the UTF-8 character before (-1) or after (1) the cursor
+void gapBufferDelete(struct gapBuffer *buffer, int direction);
 
-// Creates a new task, returns updated array of items
-ITEM **createTask(struct curlArgs curlArgs, cJSON *tasksJson);
+// Moves the cursor a UTF-8 character back (-1) or forward (1)
+void gapBufferMove(struct gapBuffer *buffer, int direction);
+
+// Returns the text without the gap, which needs to be free()-ed
+char *gapBufferString(struct gapBuffer *buffer);
+
+// Sorts tasks by priority, P1 first, then by child_order. The tasks are moved
+// out of json rather than copied, so json still needs to be freed, and is left
+// with only the tasks that have no id. A task missing its content or priority
+// gets an empty one or P4. Returns NULL on failure.
+cJSON *sortTasks(cJSON *json);
 
 // Creates new items from JSON. Needs to be free()-ed and to have an NULL
 // appended to the end of the return value.
@@ -117,24 +967,413 @@ ITEM **createItemsFromJson(cJSON *json, int customLength, char *query);
 // Very similar to getJsonValue, but returns the valueint instead.
 int getJsonIntValue(cJSON *json, char *key);
 
-// Deletes a task, returns list of new items if successfull, and null if it
-// isn't.
-ITEM **deleteTask(cJSON *tasksJson, struct curlArgs curlArgs, MENU *curMenu);
+// Starts a taskAction in view. Closing and reopening go by the task under the
+// cursor, and are sent right away, taking a closed task off the list. Creating
+// asks for the new tasks' names on the status line (a line each, sent
+// CREATE_BATCH to a request), and deleting asks to be sure before the task
+// under the cursor and its subtasks go. Anything that goes wrong is a notice.
+void startTaskAction(struct taskView *view, enum mutationType type);
+
+// Hands the key to the action asking on view's status line, which moves on
+// once it has its answer
+void answerTaskAction(struct taskView *view, int key);
+
+// Calls off whatever's asking on view's status line, the action or the
+// search, the way escape would. Views are left (and freed) without either.
+void cancelTaskPrompt(struct taskView *view);
+
+// Draws the search, or what the asking action wants, on view's status line,
+// leaving the cursor where the user's typing
+void drawTaskPrompt(struct taskView *view);
+
+// Starts the request for a change that's on screen (or is about to be),
+// copying what it needs out of args. tasks are the tasks the change touches.
+// Returns NULL if the request couldn't be started.
+struct pendingMutation *startMutation(struct taskView *view,
+                                      enum mutationType type, const char *id,
+                                      cJSON **tasks, int tasksLength,
+                                      struct curlArgs args);
+
+// Returns the change in flight for the task with id, if there is one. That
+// includes any of the tasks a batch is creating.
+struct pendingMutation *findPendingMutation(struct taskView *view,
+                                            const char *id);
+
+// Rebuilds the tree from view->json, leaving out what changes still in flight
+// have taken off the list, and redraws it. This is how a change is undone.
+void reloadTaskRows(struct taskView *view);
+
+// Shows message on the status line for NOTICE_MS, without waiting for a key
+void showTaskNotice(struct taskView *view, const char *message);
+
+// Sets up an empty stringMap with room for at least `capacity` keys. Returns 0
+// on failure.
+int stringMapInit(struct stringMap *map, int capacity);
+
+// Returns the value stored for key, or -1 if there isn't one
+int stringMapGet(struct stringMap *map, const char *key);
+
+// Removes key if it's there
+void stringMapRemove(struct stringMap *map, const char *key);
+
+// Inserts or overwrites key. Returns 0 on failure.
+int stringMapPut(struct stringMap *map, const char *key, int value);
+
+void stringMapFree(struct stringMap *map);
+
+// Builds the subtask hierarchy of a (sorted) tasks array in O(n). Roots are
+// grouped by section, and siblings keep the order they had in tasksJson. Needs
+// to be freed with freeTaskTree.
+struct taskTree *buildTaskTree(cJSON *tasksJson);
+
+void freeTaskTree(struct taskTree *tree);
+
+// Collapses or expands the subtree under node. Only touches the rows of that
+// subtree, so nothing else has to be rebuilt.
+void toggleTaskCollapsed(struct taskTree *tree, int node);
+
+// Pre-order walk of root's subtree: returns the node after cur, or -1 at the
+// end. A root of -1 walks the whole tree.
+int nextTaskInSubtree(struct taskNode *nodes, int root, int cur);
+
+// Takes node out of the tree. With keepChildren its subtasks move up a level
+// into its place, otherwise they go with it. O(subtree), and the json is left
+// for the caller to free.
+void removeTaskNode(struct taskTree *tree, int node, int keepChildren);
+
+// Adds a task without a parent or section as a new root. Returns its node, or
+// -1 on failure.
+int insertTaskNode(struct taskTree *tree, cJSON *task);
+
+// Rebuilds the visible list from what's collapsed, after a search
+void resetVisibleTasks(struct taskTree *tree);
+
+// Makes the visible list just the given nodes, in tree order
+void showOnlyTasks(struct taskTree *tree, int *matches, int length);
+
+// Draws rows [from, to) of the list window. Doesn't refresh.
+void drawTaskRows(struct taskView *view, int from, int to);
+
+// Puts the cursor back on a task that's on screen after the list changed
+// under it, keeping it as close to where it was as possible
+void settleTaskCursor(struct taskView *view);
+
+// Moves the cursor distance tasks down (or up, if it's negative), stopping at
+// either end and scrolling if needed. Only the rows that change are drawn, so
+// a run of j presses costs about the same as one.
+void moveTaskCursor(struct taskView *view, int distance);
+
+// Moves the cursor and the list a screen up (-1) or down (1). Costs a screen's
+// worth of rows however long the list is.
+void pageTaskCursor(struct taskView *view, int direction);
+
+// Moves the cursor to node (the first or last visible one for the top or
+// bottom of the list) and scrolls it into view
+void jumpTaskCursor(struct taskView *view, int node);
+
+// Sets up list->rows for list->height and list->width. Returns 0 on failure.
+int allocTaskRows(struct listView *list);
+
+// Copies as much of text as fits in columns terminal columns (and size bytes)
+// into buffer, ending with an ellipsis if it had to be cut. Wide characters
+// take two columns, and zero width ones (combining marks, joiners) stay with
+// the character before them. Returns the columns used.
+int fitTextToWidth(char *buffer, int size, const char *text, int columns);
+void freeTaskRows(struct listView *list);
+
+// Drops node's cached row after it's changed, or every cached row if node is
+// -1
+void forgetTaskRow(struct listView *list, int node);
+
+// List versions of removeTaskNode and insertTaskNode. The cursor and scroll
+// position stay put, and only rows that moved are drawn.
+void removeTaskRow(struct taskView *view, int keepChildren);
+int insertTaskRow(struct taskView *view, cJSON *task);
+
+// Builds a search index over every task in tasksJson. Needs to be freed with
+// freeSearchIndex.
+struct searchIndex *buildSearchIndex(cJSON *tasksJson);
+
+void freeSearchIndex(struct searchIndex *index);
+
+// Keep the index in step with the cache, and with new tasks while they only
+// have a temp_id. Both do nothing if it couldn't be built.
+int searchIndexAdd(struct searchIndex *index, cJSON *task);
+void searchIndexRemove(struct searchIndex *index, cJSON *task);
+
+// Finds every task whose content or description contains query (case
+// insensitive). Returns the number of matches, and points results at their doc
+// ids, which belong to the index and are valid until the next call.
+int searchIndexQuery(struct searchIndex *index, const char *query,
+                     int **results);
+
+// '/' in projectPanel. Starts a search on the status line, which narrows the
+// list down as the user types: enter keeps the results and escape goes back to
+// the full list. Keys go to answerTaskSearch until then.
+void startTaskSearch(struct taskView *view);
+void answerTaskSearch(struct taskView *view, int key);
+
+// Narrows the list to what the search's query matches, if it changed since
+// the last time. Typing is only searched for once per frame.
+void runTaskSearch(struct taskView *view);
+
+// Compiles a Todoist style filter (today, overdue, p1-p4, #Project, @label,
+// combined with &, |, ! and parentheses). Project names are kept as they are,
+// for getFilterResults to resolve against the projects as they are then.
+// Returns NULL if the query can't be parsed.
+struct filterProgram *compileFilter(const char *query);
+
+void freeFilterProgram(struct filterProgram *program);
+
+// Runs a compiled filter against a single task. today and nowMinute come from
+// getLocalDayMinute, and stack needs room for program->stackDepth ints.
+int runFilterProgram(struct filterProgram *program, struct cachedTask *task,
+                     int today, int nowMinute, int *stack);
+
+// Returns the cached tasks matching view, only re-running the filter if the
+// cache has changed since last time, or the date has (or the minute, for a
+// filter that looks at times). The return value belongs to the view.
+cJSON *getFilterResults(struct filterView *view);
+
+// Writes the local date `dayOffset` days from now as "YYYY-MM-DD" into buffer,
+// which needs room for 11 chars.
+void formatLocalDate(char *buffer, int dayOffset);
+
+// Returns the number for key, adding it (with name) if it's new. -1 on
+// failure. Both strings are copied.
+int internString(struct internTable *table, const char *key, const char *name);
+
+// Returns the number for key, or -1 if it hasn't been interned
+int lookupInterned(struct internTable *table, const char *key);
+
+void freeInternTable(struct internTable *table);
+
+// Interns a label by name. Labels are case insensitive, so this lowercases the
+// key and grows every cached task's label set if needed.
+int internLabel(const char *name);
+
+// Fills labelTable and sectionTable from the labels and sections endpoints
+void internLabelsAndSections(cJSON *labelsJson, cJSON *sectionsJson);
+
+// Sets up eventLoop, including the curl multi handle makeRequest goes through
+// and the thread that runs it. Returns 0 on failure.
+int initEventLoop(void);
+void freeEventLoop(void);
+
+// Calls handler with the epoll events whenever fd is ready. Watching an fd
+// again replaces its handler and events. Returns 0 on failure.
+int watchFd(int fd, unsigned int events,
+            void (*handler)(int fd, unsigned int events, void *data),
+            void *data);
+void unwatchFd(int fd);
+
+// Calls handler once, delay milliseconds from now. Returns an id for
+// cancelTimer, or -1 on failure.
+int addTimer(long long delay, void (*handler)(void *data), void *data);
+void cancelTimer(int id);
+
+// Makes view the one getting keys and resizes, and returns the one it
+// replaces so it can be put back
+struct eventView setEventView(struct eventView view);
+
+// Dispatches events to their handlers until stopEventLoop is called. Views
+// nest by calling this from a handler.
+void runEventLoop(void);
+void stopEventLoop(void);
+
+// Asks for the view's onFrame to be called once the keys that are ready have
+// all been handled
+void requestFrame(void);
+
+// Returns the next key typed in window, running the loop (but not the view's
+// key handler) until there is one. Used instead of getch().
+int waitForKey(WINDOW *window);
+
+// Starts curl on the event loop once nothing more urgent than request->class
+// is waiting and request->bucket has a token, and calls request->handler once
+// it's done (after which curl can be reused). If it has a restart, it's sent
+// again after a 429, a 5xx or a network error instead of failing, so it has
+// to be safe to repeat. Returns 0 if it couldn't be queued.
+int startRequest(CURL *curl, struct pendingRequest *request);
+
+// The quota a request to url counts against
+enum apiBucket apiBucketFor(const char *url);
+
+// Calls request's handler with CURLE_ABORTED_BY_CALLBACK, right away if it
+// hasn't started, or once the network thread has aborted it if it has. Does
+// nothing if it's already done.
+void cancelRequest(struct pendingRequest *request);
+
+// Puts a request that's waiting ahead of everything less urgent than class.
+// One that's running won't be preempted by anything that isn't more urgent.
+void promoteRequest(struct pendingRequest *request, enum requestClass class);
+
+// Like curl_easy_perform, but keeps timers and signals running on the event
+// loop while it waits. Keys stay queued until it's done.
+CURLcode performRequest(CURL *curl);
+
+// Runs the event loop until *pending drops to 0, with keys held back like
+// performRequest does
+void waitForPending(int *pending);
+
+// Like waitForPending, but pressing h or escape cancels request, which is what
+// *pending is waiting on. Returns 0 if the user backed out like that. Other
+// keys are kept for once it's done.
+int waitForPendingOrBack(int *pending, struct pendingRequest *request);
+
+// Starts a worker per core (up to MAX_WORKERS), handing finished jobs back
+// through the event loop, which has to be set up first. Returns 0 on failure,
+// in which case submitJob runs jobs right away instead.
+int initWorkerPool(void);
+
+// Lets the workers finish what's queued, and stops them
+void freeWorkerPool(void);
+
+// Queues job for the workers. Called from a worker, it goes on that worker's
+// own deque, so it's likely run there while its data is still in cache.
+void submitJob(struct job *job);
+
+// Waits until *pending drops to 0, for a job that has to wait on jobs it
+// submitted itself with pending as their owner. Any of those still queued
+// are run on this thread meanwhile, but nothing else is.
+void helpJobs(atomic_int *pending);
+
+// Parses text (length bytes) the way cJSON_Parse would, but if it's a big
+// top-level array, in chunks spread over the worker pool. The chunks are
+// split between elements by a scan that only looks at brackets, braces,
+// commas and strings, and spliced back together in order. Returns NULL if
+// it doesn't parse, with *error (if error isn't NULL) where it stopped.
+cJSON *parseJson(const char *text, size_t length, const char **error);
+
+// Starts request with curlArgs as a request of class, parsing the response
+// on the worker pool and passing it through prepare there too. A GET waits on
+// the same GET (with the same prepare) if it's in flight already, rather
+// than fetching it again, and doesn't use curlArgs.curl. Returns 0 if it
+// couldn't be started.
+int startJsonRequest(struct jsonRequest *request, struct curlArgs curlArgs,
+                     cJSON *(*prepare)(cJSON *json), int *pending,
+                     enum requestClass class);
+
+// Returns request's JSON once *pending has dropped, after telling the user
+// what went wrong if there isn't any. A 204 gives an empty array.
+cJSON *jsonRequestResult(struct jsonRequest *request);
+
+// Frees the GETs still in flight once the event loop's gone, and the handles
+// kept for the next ones
+void freeFetchTable(void);
+
+// Like makeRequest, but the tasks come back sorted by sortTasks, which ran on
+// the worker pool along with the parsing. The user can back out of waiting
+// for them (see waitForPendingOrBack), which sets *backedOut and gives NULL.
+cJSON *makeTasksRequest(struct curlArgs curlArgs, int *backedOut);
+
+// Starts refreshing projects' menu (and whatever view setRefreshView points
+// at) in the background, with its own handle and a copy of headers. Returns 0
+// on failure.
+int initRefresher(struct projectsView *projects, struct curl_slist *headers);
+// Only once the event loop and the workers are gone, since a refresh might
+// still be in flight
+void freeRefresher(void);
+
+// Tells the refresher which view is on screen, and what it was opened as (a
+// project id, or a filter's), which it keeps a copy of. NULL for the projects
+// menu.
+void setRefreshView(struct taskView *view, const char *viewKey);
+
+// Prefetches the project under the projects menu's cursor if it stays there,
+// and cancels a prefetch the cursor's moved away from
+void schedulePrefetch(struct projectsView *projectsView);
+
+// Called before opening viewKey. Waits for it if it's being prefetched (as a
+// REQUEST_VIEW now), so it's in the view cache once it's done, and cancels a
+// prefetch of anything else. Returns 0 if the user backed out of waiting.
+int awaitPrefetch(const char *viewKey);
+
+// Only once the event loop and the workers are gone, like freeRefresher
+void freePrefetcher(void);
+
+// Counts as the user doing something, which brings the next refresh in if
+// it's been backed off
+void noteActivity(void);
+
+// Key, resize and frame handlers for the projects menu and projectPanel
+void handleProjectsKey(int key, void *data);
+void handleTaskKey(int key, void *data);
+void presentProjectsFrame(void *data);
+void presentTaskFrame(void *data);
+
+// Fits the projects menu to stdscr. The items are left alone, only the number
+// of rows the menu shows changes.
+void handleProjectsResize(void *data);
+
+// Fits the list and status windows to the terminal. The cached rows are kept
+// unless they're too narrow or too few now, and only rows that weren't on
+// screen before are drawn.
+void handleTaskResize(void *data);
+
+// Fills in taskCache from an array of tasks, which it takes ownership of
+int initTaskCache(cJSON *tasksJson);
+
+void freeTaskCache(void);
+
+// Decodes a task's due date into days since the epoch and minutes since
+// midnight, both local time. Tasks without one get NO_DUE_DAY.
+void decodeTaskDue(cJSON *task, int *day, int *minute);
+
+// Current local day (days since 1970-01-01) and minutes since midnight
+void getLocalDayMinute(int *day, int *minute);
+
+// Inserts or removes a task, keeping the index ordered. Tasks without a due
+// date are ignored.
+int dueIndexInsert(struct dueIndex *index, struct cachedTask *task);
+void dueIndexRemove(struct dueIndex *index, struct cachedTask *task);
+
+// First position whose key is >= (day, minute)
+int dueIndexLowerBound(struct dueIndex *index, int day, int minute);
+
+// The version of what the view for key is built from: its project's, or for
+// a filter, its results', which move on with the whole cache (they can take
+// tasks from anywhere) and with the date
+unsigned long viewVersion(const char *key);
+
+// Keeps taskCache in sync with changes made from a view
+void cacheSetTaskDue(const char *id, const char *date);
+void cacheRemoveTask(const char *id);
+void cacheAddTask(cJSON *task);
+
+// Puts task in the cache in place of the cached task with the same id, or
+// adds it if there isn't one. Takes task. Returns 0 if it was the same as the
+// cached one already, in which case nothing changed.
+int cacheUpdateTask(cJSON *task);
+
+// Between these, changes to the cache move the versions on once at the end,
+// rather than once each. Only the projects that changed get a new version.
+void cacheBeginChanges(void);
+void cacheEndChanges(void);
 //
 // End Headers
 
 int main(void) {
   // ncurses. stdscr acts as the "background", and everything else sits on top
-  // of it.
+  // of it. The locale has to be set first for ncursesw to take UTF-8.
+  setlocale(LC_ALL, "");
+  renderStats.visible = getenv("TODOIST_FRAME_STATS") != NULL;
+  char *viewCacheMb = getenv("TODOIST_VIEW_CACHE_MB");
+  viewCache.budget = (size_t)(viewCacheMb != NULL ? atoi(viewCacheMb)
+                                                  : VIEW_CACHE_MB) *
+                     1024 * 1024;
   initscr();
   raw();
   noecho();
+  watchExitSignals();
   printw("Loading current projects. Press q to exit.\n");
   refresh();
 
   int row, col;
   getmaxyx(stdscr, row, col);
   keypad(stdscr, TRUE);
+  define_key("\033[200~", KEY_PASTE_START);
+  define_key("\033[201~", KEY_PASTE_END);
 
   // curl
   CURL *curl = curl_easy_init();
@@ -144,6 +1383,19 @@ int main(void) {
     printf("curl didn't initalize correctly.\n");
     return 1;
   } else {
+    if (!initEventLoop()) {
+      displayMessage("Unable to set up the event loop. Press any button to end "
+                     "the program.\n");
+      freeEventLoop();
+      curl_easy_cleanup(curl);
+      curl_global_cleanup();
+      endwin();
+      return 1;
+    }
+
+    // Without workers, jobs just run on this thread
+    initWorkerPool();
+
     // Get auth token from environment
     char *authToken = getenv("TODOIST_AUTH_TOKEN");
 
@@ -160,154 +1412,392 @@ int main(void) {
     struct curl_slist *baseHeaders = NULL;
     baseHeaders = curl_slist_append(baseHeaders, authHeader);
 
-    // Get list of projects
-    char *allProjectsUrl = combineString(BASE_REST_URL, "projects");
-    struct curlArgs allProjectsCurlArgs = {curl, baseHeaders, "GET",
-                                           allProjectsUrl};
-    cJSON *projectsJson = makeRequest(allProjectsCurlArgs);
+    // Projects, labels, sections and every active task (cached up front, so
+    // views built from filters don't need a round trip) are all fetched at
+    // once, each GET with its own handle, and parsed on the workers as they
+    // come in
+    char *startupPaths[] = {"projects", "labels", "sections", "tasks"};
+    struct jsonRequest startupRequests[4];
+    int startupPending = 0;
+    for (int i = 0; i < 4; i++) {
+      char *url = combineString(BASE_REST_URL, startupPaths[i]);
+      struct curlArgs startupCurlArgs = {
+          .headers = baseHeaders, .method = "GET", .url = url};
+      if (url == NULL ||
+          !startJsonRequest(&startupRequests[i], startupCurlArgs, NULL,
+                            &startupPending, REQUEST_VIEW)) {
+        startupRequests[i] = (struct jsonRequest){.curl = NULL};
+      }
+      free(url);
+    }
+    waitForPending(&startupPending);
+    cJSON *startupJson[4];
+    for (int i = 0; i < 4; i++) {
+      startupJson[i] = jsonRequestResult(&startupRequests[i]);
+    }
+
+    cJSON *projectsJson = startupJson[0];
     int numOfProjects = cJSON_GetArraySize(projectsJson);
 
-    // Adding a cJSON object so the user can also view active tasks (AKA the
-    // today section)
-    cJSON *today = cJSON_CreateObject();
-    if (today == NULL) {
+    // Labels and sections first, so tasks can be tied to them as they're
+    // cached
+    cJSON *labelsJson = startupJson[1];
+    cJSON *sectionsJson = startupJson[2];
+    internLabelsAndSections(labelsJson, sectionsJson);
+    cJSON_Delete(labelsJson);
+    cJSON_Delete(sectionsJson);
+
+    // Everything the cleanup under end frees, so jumping there early is safe
+    char *filtersConfig = NULL;
+    int filterViewsLength = 0;
+    struct filterView *filterViews = NULL;
+    MENU *projectsMenu = NULL;
+    ITEM **projectsItems = NULL;
+
+    cJSON *allTasksJson = startupJson[3];
+    if (!initTaskCache(allTasksJson != NULL ? allTasksJson
+                                            : cJSON_CreateArray())) {
+      displayMessage("Couldn't cache tasks. Press any key to quit.");
       goto end;
     }
-    if (cJSON_AddStringToObject(today, "name", "Today") == NULL) {
+
+    // Today is just a built in filter. More can be added through
+    // TODOIST_FILTERS, formatted like "Name=query;Other name=query".
+    char *filtersEnv = getenv("TODOIST_FILTERS");
+    filtersConfig =
+        combineString("Today=today;", filtersEnv == NULL ? "" : filtersEnv);
+    if (filtersConfig == NULL) {
       goto end;
     }
 
-    // Adding a "fake" ID field to help with managing menu (see event loop ~20
-    // lines down)
-    if (cJSON_AddStringToObject(today, "id", "999") == NULL) {
+    // Every entry needs at least an '=' and a query
+    filterViews =
+        calloc(strlen(filtersConfig) / 2 + 1, sizeof(struct filterView));
+    if (filterViews == NULL) {
       goto end;
     }
-    cJSON_AddItemToArray(projectsJson, today);
 
-    MENU *projectsMenu = renderMenuFromJson(projectsJson, "name");
+    // Filters that don't compile are named in one message once they've all
+    // been tried, rather than a key press each
+    char *badFilters = NULL;
+    char *savePtr = NULL;
+    for (char *entry = strtok_r(filtersConfig, ";", &savePtr); entry != NULL;
+         entry = strtok_r(NULL, ";", &savePtr)) {
+      char *separator = strchr(entry, '=');
+      if (separator == NULL) {
+        continue;
+      }
+      *separator = '\0';
+
+      struct filterView *view = &filterViews[filterViewsLength];
+      view->name = entry;
+      view->query = separator + 1;
+      view->program = compileFilter(view->query);
+      if (view->program == NULL) {
+        char *joined = NULL;
+        if (badFilters == NULL) {
+          joined = strdup(view->name);
+        } else {
+          char *withComma = combineString(badFilters, ", ");
+          joined =
+              withComma == NULL ? NULL : combineString(withComma, view->name);
+          free(withComma);
+        }
+        if (joined != NULL) {
+          free(badFilters);
+          badFilters = joined;
+        }
+        continue;
+      }
+      filterViewsLength++;
+    }
+    if (badFilters != NULL) {
+      char *named =
+          combineString("Couldn't understand the filters for ", badFilters);
+      char *message =
+          named == NULL ? NULL
+                        : combineString(named, ". Press any key to continue.");
+      if (message != NULL) {
+        displayMessage(message);
+      }
+      free(message);
+      free(named);
+      free(badFilters);
+    }
+
+    // Adding cJSON objects so the user can also view the filters (Today
+    // included). The ID is "fake", and helps with managing the menu (see event
+    // loop ~20 lines down)
+    for (int i = 0; i < filterViewsLength; i++) {
+      cJSON *filterViewJson = cJSON_CreateObject();
+      if (filterViewJson == NULL) {
+        goto end;
+      }
+      if (cJSON_AddStringToObject(filterViewJson, "name",
+                                  filterViews[i].name) == NULL) {
+        goto end;
+      }
+
+      char filterViewId[32];
+      snprintf(filterViewId, sizeof(filterViewId), "%s%d",
+               FILTER_VIEW_ID_PREFIX, i);
+      if (cJSON_AddStringToObject(filterViewJson, "id", filterViewId) ==
+          NULL) {
+        goto end;
+      }
+      cJSON_AddItemToArray(projectsJson, filterViewJson);
+    }
+
+    projectsMenu = renderMenuFromJson(projectsJson, "name");
     if (projectsMenu == NULL) {
       goto end;
     }
 
     // Render
-    clear();
+    erase();
     set_menu_mark(projectsMenu, NULL);
+    set_menu_format(projectsMenu, row, 1);
     post_menu(projectsMenu);
     refresh();
 
     // For free()-ing
-    ITEM **projectsItems = menu_items(projectsMenu);
-
-    int getchChar;
-    while ((getchChar = getch()) != 'q') {
-      if (getchChar == 'j') {
-        menu_driver(projectsMenu, REQ_DOWN_ITEM);
-      } else if (KEY_UP || getchChar == 'k') {
-        menu_driver(projectsMenu, REQ_UP_ITEM);
-      } else if (getchChar == 'q') {
-        break;
-      } else if (getchChar == 'l') {
-        // Find project ID, and call projectPanel with that project ID in a
-        // curlArgs struct
-        cJSON *currentItemJson = getCurrentItemJson(projectsMenu, projectsJson);
-        if (currentItemJson == NULL) {
-          displayMessage(
-              "Something went wrong when trying to access the current "
-              "item of the Ncurses menu. Press any key to quit.");
-          goto end;
-        }
-        cJSON *projectIDJson =
-            cJSON_GetObjectItemCaseSensitive(currentItemJson, "id");
-        if (projectIDJson == NULL) {
-          displayMessage("JSON for project ID is null. Press any key to quit.");
-          goto end;
-        }
-
-        char *projectID = projectIDJson->valuestring;
-        char *tasksUrl;
-        if (strcmp(projectID, "999") == 0) {
-          tasksUrl = combineString(BASE_REST_URL, "tasks/?filter=today");
-        } else {
-          tasksUrl = combineString(BASE_REST_URL, "tasks/?project_id=");
-          tasksUrl = combineString(tasksUrl, projectID);
-        }
-
-        struct curlArgs projectPanelCurlArgs = {curl, baseHeaders, "GET",
-                                                tasksUrl};
-        projectPanel(projectPanelCurlArgs, row, col);
-
-        // Scuffed fix for projects list not loading after exiting from
-        // project panel
-        menu_driver(projectsMenu, REQ_NEXT_ITEM);
-        menu_driver(projectsMenu, REQ_PREV_ITEM);
-
-        // Once projectPanel returns, the user has exited the panel.
-        free(tasksUrl);
-      }
-    }
+    projectsItems = menu_items(projectsMenu);
+
+    struct projectsView projectsView = {.menu = projectsMenu,
+                                        .json = projectsJson,
+                                        .filterViews = filterViews,
+                                        .curl = curl,
+                                        .headers = baseHeaders,
+                                        .row = row,
+                                        .col = col};
+    setEventView((struct eventView){.onKey = handleProjectsKey,
+                                    .onResize = handleProjectsResize,
+                                    .onFrame = presentProjectsFrame,
+                                    .data = &projectsView});
+    // Without it, things only change when they're opened
+    initRefresher(&projectsView, baseHeaders);
+    runEventLoop();
+
+    // The refresh might have rebuilt the menu since
+    projectsMenu = projectsView.menu;
+    projectsItems = menu_items(projectsMenu);
+    numOfProjects = item_count(projectsMenu);
 
   end:
     // Cleanup and free variables
+    for (int i = 0; i < filterViewsLength; i++) {
+      freeFilterProgram(filterViews[i].program);
+      cJSON_Delete(filterViews[i].results);
+    }
+    free(filterViews);
+    free(filtersConfig);
+    freeViewCache();
+    freeTaskCache();
+    freeInternTable(&labelTable);
+    freeInternTable(&sectionTable);
+    freeWorkerPool();
+    freeEventLoop();
+    // Only now is nothing going to touch their handles
+    freeRefresher();
+    freePrefetcher();
+    freeFetchTable();
     curl_easy_cleanup(curl);
     free(authHeader);
     free(projectsMenu);
     free(projectsJson);
-    for (int i = 0; i < numOfProjects; i++) {
+    for (int i = 0; projectsItems != NULL && i < numOfProjects; i++) {
       free(projectsItems[i]);
     }
+    // A task left half typed could still have it on
+    setBracketedPaste(0);
     endwin();
   }
   curl_global_cleanup();
 }
 
-char *displayInputField(char *infoText) {
-  // Fields
-  const int lineLength = 50;
-  FIELD *input[2];
-  input[0] = new_field(1, lineLength, 0, 0, 0, 0);
-  set_field_back(input[0], A_UNDERLINE);
-  input[1] = NULL;
+void setBracketedPaste(int on) {
+  if (bracketedPaste == on) {
+    return;
+  }
+  bracketedPaste = on;
+  // putp leaves it in stdout's buffer, where nothing else would flush it
+  // until the program exits
+  putp(on ? "\033[?2004h" : "\033[?2004l");
+  fflush(stdout);
+}
 
-  // Forms
-  FORM *form = new_form(input);
+static void handleExitSignal(int signalNumber) {
+  // ncurses' output can't be touched from here, so this goes straight out
+  if (bracketedPaste) {
+    static const char off[] = "\033[?2004l";
+    int savedErrno = errno;
+    if (write(STDOUT_FILENO, off, sizeof(off) - 1) == -1) {
+      // Nothing else to try on the way out
+    }
+    errno = savedErrno;
+    bracketedPaste = 0;
+  }
 
-  // Render
-  clear();
-  post_form(form);
-  refresh();
+  int i = 0;
+  while (exitSignals[i] != signalNumber) {
+    i++;
+  }
+  if (exitActions[i].sa_handler != SIG_DFL) {
+    exitActions[i].sa_handler(signalNumber);
+    return;
+  }
+  sigaction(signalNumber, &exitActions[i], NULL);
+  raise(signalNumber);
+}
+
+void watchExitSignals(void) {
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = handleExitSignal;
+  sigemptyset(&action.sa_mask);
+  for (int i = 0; i < 3; i++) {
+    // Ones that are ignored (like SIGHUP under nohup) stay that way
+    if (sigaction(exitSignals[i], NULL, &exitActions[i]) == 0 &&
+        exitActions[i].sa_handler != SIG_IGN &&
+        !(exitActions[i].sa_flags & SA_SIGINFO)) {
+      sigaction(exitSignals[i], &action, NULL);
+    }
+  }
+}
 
-  // Event loop
-  int getchChar = 0;
-  char *res = malloc(lineLength + 1);
+// Decodes the character at text into its width in columns, the same way
+// fitTextToWidth counts it. Returns how many bytes it took.
+static int inputCharWidth(const char *text, int length, int *width) {
+  mbstate_t state;
+  memset(&state, 0, sizeof(state));
+  wchar_t wide;
+  size_t bytes = mbrtowc(&wide, text, length, &state);
+  if (bytes == (size_t)-1 || bytes == (size_t)-2 || bytes == 0) {
+    *width = 1;
+    return 1;
+  }
+  *width = wcwidth(wide);
+  if (*width < 0) {
+    *width = 1;
+  }
+  return (int)bytes;
+}
 
-  if (!res) {
-    return NULL;
+void drawInputLine(WINDOW *window, int y, struct gapBuffer *buffer) {
+  int columns = getmaxx(window);
+  char *text = gapBufferString(buffer);
+  if (text == NULL) {
+    return;
+  }
+  for (char *newline = strchr(text, '\n'); newline != NULL;
+       newline = strchr(newline + 1, '\n')) {
+    *newline = ' ';
   }
 
-  int i = 0;
-  while ((getchChar = getch()) != 'q') {
-    if (getchChar == KEY_BACKSPACE) {
-      form_driver(form, REQ_DEL_PREV);
-      res[i] = '\0';
-      i--;
-    } else if (getchChar == KEY_ENTER || getchChar == 10) {
-      form_driver(form, REQ_VALIDATION);
-      break;
-    } else {
-      form_driver(form, getchChar);
-      // Yes, this isn't how this should be done. It's the best way though.
-      res[i] = getchChar;
-      i++;
+  // Start far enough in that what's before the cursor leaves it a column
+  int beforeWidth = 0;
+  int width;
+  for (int i = 0; i < buffer->gapStart;
+       i += inputCharWidth(text + i, buffer->gapStart - i, &width)) {
+    beforeWidth += width;
+  }
+  int start = 0;
+  while (beforeWidth > columns - 1) {
+    start += inputCharWidth(text + start, buffer->gapStart - start, &width);
+    beforeWidth -= width;
+  }
+
+  int size = columns * MB_LEN_MAX + 1;
+  char *line = malloc(size);
+  if (line != NULL) {
+    fitTextToWidth(line, size, text + start, columns);
+    wmove(window, y, 0);
+    wclrtoeol(window);
+    wattron(window, A_UNDERLINE);
+    waddstr(window, line);
+    wattroff(window, A_UNDERLINE);
+    wmove(window, y, beforeWidth);
+  }
+  free(line);
+  free(text);
+}
+
+int gapBufferInit(struct gapBuffer *buffer, int capacity) {
+  buffer->text = malloc(capacity);
+  buffer->gapStart = 0;
+  buffer->gapEnd = capacity;
+  buffer->capacity = capacity;
+  return buffer->text != NULL;
+}
+
+void gapBufferFree(struct gapBuffer *buffer) { free(buffer->text); }
+
+int gapBufferInsert(struct gapBuffer *buffer, const char *bytes, int length) {
+  if (buffer->gapEnd - buffer->gapStart < length) {
+    // Doubling keeps a long paste to a handful of copies
+    int after = buffer->capacity - buffer->gapEnd;
+    int capacity = buffer->capacity * 2;
+    while (capacity - buffer->gapStart - after < length) {
+      capacity *= 2;
+    }
+    char *text = realloc(buffer->text, capacity);
+    if (text == NULL) {
+      return 0;
+    }
+    memmove(text + capacity - after, text + buffer->gapEnd, after);
+    buffer->text = text;
+    buffer->gapEnd = capacity - after;
+    buffer->capacity = capacity;
+  }
+  memcpy(buffer->text + buffer->gapStart, bytes, length);
+  buffer->gapStart += length;
+  return 1;
+}
+
+// Continuation bytes are 10xxxxxx, so a character starts on anything else
+static int isUtf8Continuation(char byte) { return (byte & 0xc0) == 0x80; }
+
+void gapBufferDelete(struct gapBuffer *buffer, int direction) {
+  if (direction < 0) {
+    while (buffer->gapStart > 0 &&
+           isUtf8Continuation(buffer->text[--buffer->gapStart])) {
+    }
+  } else if (buffer->gapEnd < buffer->capacity) {
+    buffer->gapEnd++;
+    while (buffer->gapEnd < buffer->capacity &&
+           isUtf8Continuation(buffer->text[buffer->gapEnd])) {
+      buffer->gapEnd++;
     }
-    refresh();
   }
+}
 
-  res[i] = '\0';
+void gapBufferMove(struct gapBuffer *buffer, int direction) {
+  if (direction < 0) {
+    while (buffer->gapStart > 0) {
+      char byte = buffer->text[--buffer->gapStart];
+      buffer->text[--buffer->gapEnd] = byte;
+      if (!isUtf8Continuation(byte)) {
+        break;
+      }
+    }
+  } else if (buffer->gapEnd < buffer->capacity) {
+    do {
+      buffer->text[buffer->gapStart++] = buffer->text[buffer->gapEnd++];
+    } while (buffer->gapEnd < buffer->capacity &&
+             isUtf8Continuation(buffer->text[buffer->gapEnd]));
+  }
+}
 
-  unpost_form(form);
-  free_form(form);
-  free_field(input[0]);
-  return res;
+char *gapBufferString(struct gapBuffer *buffer) {
+  int after = buffer->capacity - buffer->gapEnd;
+  char *string = malloc(buffer->gapStart + after + 1);
+  if (string == NULL) {
+    return NULL;
+  }
+  memcpy(string, buffer->text, buffer->gapStart);
+  memcpy(string + buffer->gapStart, buffer->text + buffer->gapEnd, after);
+  string[buffer->gapStart + after] = '\0';
+  return string;
 }
 
 char *combineString(char *str1, char *str2) {
@@ -340,68 +1830,442 @@ static size_t curlWriteHelper(char *data, size_t size, size_t nmemb,
 }
 
 void displayMessage(char *message) {
-  clear();
+  erase();
   printw("%s", message);
   refresh();
-  getch();
-  clear();
+  waitForKey(stdscr);
+  erase();
 }
 
-cJSON *makeRequest(struct curlArgs curlArgs) {
-  struct memory requestData;
-  cJSON *requestsJson;
+// Bytes this thread has written so far, by the kernel's count. -1 if that
+// isn't available.
+static long long readBytesWritten(void) {
+  static int fd = -2;
+  if (fd == -2) {
+    fd = open("/proc/thread-self/io", O_RDONLY | O_CLOEXEC);
+  }
+  if (fd < 0) {
+    return -1;
+  }
 
-  requestData.response = malloc(1);
-  requestData.size = 0;
+  char buffer[512];
+  ssize_t length = pread(fd, buffer, sizeof(buffer) - 1, 0);
+  if (length <= 0) {
+    return -1;
+  }
+  buffer[length] = '\0';
+  char *wchar = strstr(buffer, "wchar: ");
+  return wchar == NULL ? -1 : atoll(wchar + strlen("wchar: "));
+}
 
-  CURL *curl = curlArgs.curl;
+void presentFrame(void) {
+  long long before = readBytesWritten();
+  doupdate();
+  long long after = readBytesWritten();
+  if (before >= 0 && after >= before) {
+    renderStats.frameBytes = after - before;
+    renderStats.totalBytes += renderStats.frameBytes;
+  }
+  renderStats.frames++;
+}
 
-  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curlWriteHelper);
-  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, curlArgs.headers);
-  curl_easy_setopt(curl, CURLOPT_URL, curlArgs.url);
-  curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&requestData);
-  curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, curlArgs.method);
+void drawFrameStats(WINDOW *window) {
+  if (!renderStats.visible) {
+    return;
+  }
+  long long throttledMs = 0;
+  unsigned long rejected = 0;
+  for (int i = 0; i < BUCKETS; i++) {
+    throttledMs += eventLoop.buckets[i].throttledMs;
+    rejected += eventLoop.buckets[i].rejected;
+  }
+  char stats[256];
+  int length = snprintf(
+      stats, sizeof(stats),
+      " %llu bytes, %d views cached (%zuKB), %lu hits, %lu misses, %lu evicted,"
+      " %llds throttled, %lu rate limited, %lu retried, %lu/%lu GETs shared",
+      renderStats.frameBytes, viewCache.length, viewCache.bytes / 1024,
+      viewCache.hits, viewCache.misses, viewCache.evictions,
+      throttledMs / 1000, rejected, eventLoop.retries, fetchTable.shared,
+      fetchTable.started + fetchTable.shared);
+  int width = getmaxx(window);
+  if (length < width) {
+    mvwaddstr(window, 0, width - length, stats);
+  }
+}
 
-  if (curlArgs.postFields != NULL) {
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, curlArgs.postFields);
-  } else {
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, "");
+// Runs on a worker
+static void parseJsonResponse(void *data) {
+  struct jsonRequest *request = (struct jsonRequest *)data;
+  request->json = parseJson(request->response.response,
+                            request->response.size, &request->error);
+  if (request->json != NULL && request->prepare != NULL) {
+    request->json = request->prepare(request->json);
   }
+}
 
-  CURLcode res = curl_easy_perform(curl);
-  if (res != CURLE_OK) {
-    displayMessage("curl_easy_perform() failed.");
-  } else {
-    long httpCode = 0;
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpCode);
+static void finishJsonParse(void *data) {
+  struct jsonRequest *request = (struct jsonRequest *)data;
+  (*request->pending)--;
+  if (request->finish != NULL) {
+    request->finish(request);
+  }
+}
 
-    if (httpCode == 204) {
-      cJSON *blank = cJSON_CreateArray();
-      return blank;
-    }
+// Cancelling a request waiting on a fetch only stops it waiting. The fetch is
+// cancelled along with the last one.
+static void leaveFetch(struct jsonRequest *request, CURLcode result) {
+  struct sharedFetch *fetch = request->fetch;
+  struct jsonRequest **link = &fetch->waiters;
+  while (*link != request) {
+    link = &(*link)->nextWaiter;
+  }
+  *link = request->nextWaiter;
+  request->fetch = NULL;
+  request->result = result;
+  if (fetch->waiters == NULL) {
+    fetch->abandoned = 1;
+    cancelRequest(&fetch->request);
+  }
+  finishJsonParse(request);
+}
 
-    requestsJson = cJSON_Parse(requestData.response);
+static void finishJsonRequest(CURL *curl, CURLcode result, void *data) {
+  struct jsonRequest *request = (struct jsonRequest *)data;
+  // Only cancelling finishes a request that's waiting on a fetch
+  if (request->fetch != NULL) {
+    leaveFetch(request, result);
+    return;
+  }
+  request->result = result;
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &request->httpCode);
+  if (result != CURLE_OK || request->httpCode == 204) {
+    finishJsonParse(request);
+    return;
+  }
+  request->job = (struct job){.run = parseJsonResponse,
+                              .finish = finishJsonParse,
+                              .data = request};
+  submitJob(&request->job);
+}
 
-    if (requestsJson == NULL) {
-      const char *error_ptr = cJSON_GetErrorPtr();
-      if (error_ptr != NULL) {
-        // Can't use displayMessage because of `const char *`.
-        clear();
-        printw("%s", error_ptr);
-        refresh();
-        getch();
-        clear();
-      } else {
-        displayMessage("Failed to parse JSON. Error could not be shown.");
+// Preempted or failed, it starts over with nothing
+static void restartJsonRequest(void *data) {
+  struct jsonRequest *request = (struct jsonRequest *)data;
+  request->response.size = 0;
+  request->response.response[0] = '\0';
+}
+
+// Runs on a worker
+static void parseFetchResponse(void *data) {
+  struct sharedFetch *fetch = (struct sharedFetch *)data;
+  fetch->json = parseJson(fetch->response.response, fetch->response.size,
+                          &fetch->error);
+  if (fetch->json != NULL && fetch->prepare != NULL) {
+    fetch->json = fetch->prepare(fetch->json);
+  }
+}
+
+// Keeps fetch's handle for the next one, since it still has the connection
+// and DNS caches
+static void freeFetch(struct sharedFetch *fetch) {
+  if (fetch->curl != NULL && fetchTable.spareLength < MAX_TRANSFERS) {
+    curl_easy_reset(fetch->curl);
+    fetchTable.spare[fetchTable.spareLength++] = fetch->curl;
+  } else {
+    curl_easy_cleanup(fetch->curl);
+  }
+  curl_slist_free_all(fetch->headers);
+  free(fetch->response.response);
+  cJSON_Delete(fetch->json);
+  free(fetch->url);
+  free(fetch);
+}
+
+// Hands what fetch got to everyone waiting on it. The last one gets the JSON
+// (and the response its error points into), and the rest get copies.
+static void finishFetchParse(void *data) {
+  struct sharedFetch *fetch = (struct sharedFetch *)data;
+  struct sharedFetch **link = &fetchTable.fetches;
+  while (*link != fetch) {
+    link = &(*link)->next;
+  }
+  *link = fetch->next;
+
+  // They're all done before any finish is called, since one might cancel
+  // another
+  struct jsonRequest *waiters = fetch->waiters;
+  fetch->waiters = NULL;
+  for (struct jsonRequest *request = waiters; request != NULL;
+       request = request->nextWaiter) {
+    request->request.state = REQUEST_IDLE;
+    request->fetch = NULL;
+    request->result = fetch->result;
+    request->httpCode = fetch->httpCode;
+    if (request->nextWaiter == NULL) {
+      free(request->response.response);
+      request->response = fetch->response;
+      request->json = fetch->json;
+      request->error = fetch->error;
+      fetch->response.response = NULL;
+      fetch->json = NULL;
+      continue;
+    }
+    request->json = cJSON_Duplicate(fetch->json, 1);
+    if (fetch->error != NULL) {
+      char *error = strdup(fetch->error);
+      if (error != NULL) {
+        free(request->response.response);
+        request->response.response = error;
       }
+      request->error = error;
+    }
+  }
+  while (waiters != NULL) {
+    struct jsonRequest *request = waiters;
+    waiters = request->nextWaiter;
+    finishJsonParse(request);
+  }
+  freeFetch(fetch);
+}
+
+static void finishFetch(CURL *curl, CURLcode result, void *data) {
+  struct sharedFetch *fetch = (struct sharedFetch *)data;
+  fetch->result = result;
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &fetch->httpCode);
+  if (result != CURLE_OK || fetch->httpCode == 204 || fetch->waiters == NULL) {
+    finishFetchParse(fetch);
+    return;
+  }
+  fetch->job = (struct job){.run = parseFetchResponse,
+                            .finish = finishFetchParse,
+                            .data = fetch};
+  submitJob(&fetch->job);
+}
+
+static void restartFetch(void *data) {
+  struct sharedFetch *fetch = (struct sharedFetch *)data;
+  fetch->response.size = 0;
+  fetch->response.response[0] = '\0';
+}
+
+static struct sharedFetch *startFetch(struct curlArgs curlArgs,
+                                      cJSON *(*prepare)(cJSON *json),
+                                      enum requestClass class) {
+  struct sharedFetch *fetch = calloc(1, sizeof(struct sharedFetch));
+  if (fetch == NULL) {
+    return NULL;
+  }
+  fetch->url = strdup(curlArgs.url);
+  fetch->prepare = prepare;
+  fetch->response.response = calloc(1, 1);
+  for (struct curl_slist *header = curlArgs.headers; header != NULL;
+       header = header->next) {
+    fetch->headers = curl_slist_append(fetch->headers, header->data);
+  }
+  fetch->curl = fetchTable.spareLength > 0
+                    ? fetchTable.spare[--fetchTable.spareLength]
+                    : curl_easy_init();
+  if (fetch->url == NULL || fetch->response.response == NULL ||
+      fetch->curl == NULL) {
+    freeFetch(fetch);
+    return NULL;
+  }
+
+  CURL *curl = fetch->curl;
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curlWriteHelper);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&fetch->response);
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, fetch->headers);
+  curl_easy_setopt(curl, CURLOPT_URL, fetch->url);
+  fetch->request = (struct pendingRequest){.handler = finishFetch,
+                                           .data = fetch,
+                                           .class = class,
+                                           .restart = restartFetch,
+                                           .bucket = apiBucketFor(fetch->url)};
+  if (!startRequest(curl, &fetch->request)) {
+    freeFetch(fetch);
+    return NULL;
+  }
+  fetch->next = fetchTable.fetches;
+  fetchTable.fetches = fetch;
+  fetchTable.started++;
+  return fetch;
+}
+
+// Has request wait on the GET of curlArgs.url that's in flight, or starts one
+static int startSharedRequest(struct jsonRequest *request,
+                              struct curlArgs curlArgs,
+                              enum requestClass class) {
+  struct sharedFetch *fetch = fetchTable.fetches;
+  while (fetch != NULL &&
+         (fetch->abandoned || fetch->prepare != request->prepare ||
+          strcmp(fetch->url, curlArgs.url) != 0)) {
+    fetch = fetch->next;
+  }
+  if (fetch != NULL) {
+    fetchTable.shared++;
+    promoteRequest(&fetch->request, class);
+  } else {
+    fetch = startFetch(curlArgs, request->prepare, class);
+    if (fetch == NULL) {
+      return 0;
+    }
+  }
+
+  request->fetch = fetch;
+  request->nextWaiter = fetch->waiters;
+  fetch->waiters = request;
+  request->request = (struct pendingRequest){
+      .handler = finishJsonRequest, .data = request, .class = class};
+  request->request.state = REQUEST_ATTACHED;
+  request->request.attachedTo = &fetch->request;
+  return 1;
+}
+
+int startJsonRequest(struct jsonRequest *request, struct curlArgs curlArgs,
+                     cJSON *(*prepare)(cJSON *json), int *pending,
+                     enum requestClass class) {
+  *request = (struct jsonRequest){.curl = curlArgs.curl};
+  request->prepare = prepare;
+  request->pending = pending;
+  // An empty body, like a 5xx's, still has to parse as a string
+  request->response.response = calloc(1, 1);
+  request->response.size = 0;
+  if (request->response.response == NULL) {
+    return 0;
+  }
+
+  // GETs can be shared, since they don't change anything
+  if (eventLoop.multi != NULL && strcmp(curlArgs.method, "GET") == 0) {
+    if (!startSharedRequest(request, curlArgs, class)) {
+      free(request->response.response);
+      request->response.response = NULL;
+      return 0;
+    }
+    (*pending)++;
+    return 1;
+  }
+
+  CURL *curl = curlArgs.curl;
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curlWriteHelper);
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, curlArgs.headers);
+  curl_easy_setopt(curl, CURLOPT_URL, curlArgs.url);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&request->response);
+  curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, curlArgs.method);
+
+  if (curlArgs.postFields != NULL) {
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, curlArgs.postFields);
+  } else {
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, "");
+  }
+
+  (*pending)++;
+  // Without a loop it all happens right here
+  if (eventLoop.multi == NULL) {
+    finishJsonRequest(curl, curl_easy_perform(curl), request);
+    return 1;
+  }
+  request->request =
+      (struct pendingRequest){.handler = finishJsonRequest,
+                              .data = request,
+                              .class = class,
+                              .restart = restartJsonRequest,
+                              .bucket = apiBucketFor(curlArgs.url)};
+  if (!startRequest(curl, &request->request)) {
+    (*pending)--;
+    request->finish = NULL;
+    free(request->response.response);
+    request->response.response = NULL;
+    return 0;
+  }
+  return 1;
+}
+
+cJSON *jsonRequestResult(struct jsonRequest *request) {
+  cJSON *requestsJson = NULL;
+
+  if (request->response.response == NULL) {
+    displayMessage("curl_easy_perform() failed.");
+  } else if (request->result == CURLE_ABORTED_BY_CALLBACK) {
+    // Cancelled, so there's nothing to tell
+  } else if (request->result != CURLE_OK) {
+    displayMessage("curl_easy_perform() failed.");
+  } else if (request->httpCode == 204) {
+    requestsJson = cJSON_CreateArray();
+  } else if (request->json == NULL) {
+    if (request->error != NULL) {
+      // Can't use displayMessage because of `const char *`.
+      erase();
+      printw("%s", request->error);
+      refresh();
+      waitForKey(stdscr);
+      erase();
     } else {
-      return requestsJson;
+      displayMessage("Failed to parse JSON. Error could not be shown.");
     }
+  } else {
+    requestsJson = request->json;
   }
 
+  free(request->response.response);
+  request->response.response = NULL;
   return requestsJson;
 }
 
+// Without backedOut, the user can't back out of waiting
+static cJSON *awaitJsonRequest(struct curlArgs curlArgs,
+                               cJSON *(*prepare)(cJSON *json),
+                               enum requestClass class, int *backedOut) {
+  struct jsonRequest request;
+  int pending = 0;
+  int waited = 1;
+  if (startJsonRequest(&request, curlArgs, prepare, &pending, class)) {
+    if (backedOut == NULL) {
+      waitForPending(&pending);
+    } else {
+      waited = waitForPendingOrBack(&pending, &request.request);
+    }
+  }
+  if (backedOut != NULL) {
+    *backedOut = !waited;
+  }
+
+  // It might have got all the way here anyway, but it isn't wanted
+  if (!waited) {
+    free(request.response.response);
+    cJSON_Delete(request.json);
+    return NULL;
+  }
+  return jsonRequestResult(&request);
+}
+
+cJSON *makeRequest(struct curlArgs curlArgs) {
+  return awaitJsonRequest(curlArgs, NULL, REQUEST_INTERACTIVE, NULL);
+}
+
+// sortTasks leaves the tasks it didn't take behind in json
+static cJSON *prepareTasks(cJSON *json) {
+  cJSON *sorted = sortTasks(json);
+  cJSON_Delete(json);
+  return sorted;
+}
+
+cJSON *makeTasksRequest(struct curlArgs curlArgs, int *backedOut) {
+  return awaitJsonRequest(curlArgs, prepareTasks, REQUEST_VIEW, backedOut);
+}
+
+void freeFetchTable(void) {
+  while (fetchTable.fetches != NULL) {
+    struct sharedFetch *fetch = fetchTable.fetches;
+    fetchTable.fetches = fetch->next;
+    freeFetch(fetch);
+  }
+  for (int i = 0; i < fetchTable.spareLength; i++) {
+    curl_easy_cleanup(fetchTable.spare[i]);
+  }
+  memset(&fetchTable, 0, sizeof(fetchTable));
+}
+
 MENU *renderMenuFromJson(cJSON *json, char *query) {
   cJSON *currentTask = NULL;
   int itemsLength = cJSON_GetArraySize(json);
@@ -429,615 +2293,5618 @@ cJSON *getCurrentItemJson(MENU *menu, cJSON *json) {
   return currentItemJson;
 }
 
+// A task on its way into sortTasks' result
+struct sortingTask {
+  cJSON *task;
+  int order;
+  // Where it was in json, which breaks ties so the sort is stable
+  int position;
+};
+
+static int compareTaskOrder(const void *a, const void *b) {
+  const struct sortingTask *first = a;
+  const struct sortingTask *second = b;
+  if (first->order != second->order) {
+    return first->order < second->order ? -1 : 1;
+  }
+  return first->position - second->position;
+}
+
+// Fills in what sortTasks needs and the task doesn't have, and returns its
+// priority. 0 means it can't be listed at all.
+static int repairTask(cJSON *task) {
+  // Without an id there's nothing to close, reopen or delete it by
+  if (!cJSON_IsString(cJSON_GetObjectItemCaseSensitive(task, "id"))) {
+    return 0;
+  }
+  if (!cJSON_IsString(cJSON_GetObjectItemCaseSensitive(task, "content"))) {
+    cJSON_DeleteItemFromObjectCaseSensitive(task, "content");
+    if (cJSON_AddStringToObject(task, "content", "") == NULL) {
+      return 0;
+    }
+  }
+  cJSON *priority = cJSON_GetObjectItemCaseSensitive(task, "priority");
+  if (!cJSON_IsNumber(priority) || priority->valueint < 1 ||
+      priority->valueint > 4) {
+    cJSON_DeleteItemFromObjectCaseSensitive(task, "priority");
+    priority = cJSON_AddNumberToObject(task, "priority", 1);
+  }
+  return priority == NULL ? 0 : priority->valueint;
+}
+
+// Todoist's own order among siblings. Sync items call it child_order, REST
+// tasks just order. Tasks without one go after those that have one.
+static int getTaskOrder(cJSON *task) {
+  cJSON *order = cJSON_GetObjectItemCaseSensitive(task, "child_order");
+  if (!cJSON_IsNumber(order)) {
+    order = cJSON_GetObjectItemCaseSensitive(task, "order");
+  }
+  return cJSON_IsNumber(order) ? order->valueint : INT_MAX;
+}
+
 cJSON *sortTasks(cJSON *json) {
   int tasksLength = cJSON_GetArraySize(json);
   cJSON *tasksJson = cJSON_CreateArray();
-  if (tasksJson == NULL) {
+  struct sortingTask *sortedTasks =
+      malloc((tasksLength + 1) * sizeof(struct sortingTask));
+  int *priorities = malloc((tasksLength + 1) * sizeof(int));
+  if (tasksJson == NULL || sortedTasks == NULL || priorities == NULL) {
+    cJSON_Delete(tasksJson);
+    free(sortedTasks);
+    free(priorities);
     return NULL;
   }
 
   // Todoist priorities come in the form: P1 = 4, P4 = 1. Why? Only a higher
-  // power knows.
-  // TODO
+  // power knows. Counting them first means every task lands in its priority
+  // in one more pass, and only the tasks within one are sorted by order.
+  int starts[5] = {0};
+  int position = 0;
   cJSON *task = NULL;
-  int target = 4;
-  while (cJSON_GetArraySize(tasksJson) <= tasksLength && target >= 1) {
-    cJSON_ArrayForEach(task, json) {
-      // Get all the values that we're going to need
-      cJSON *curPriority = cJSON_GetObjectItemCaseSensitive(task, "priority");
-      if (curPriority == NULL) {
-        return NULL;
-      }
-      if (!cJSON_IsNumber(curPriority)) {
-        return NULL;
-      }
-
-      cJSON *curContent = cJSON_GetObjectItemCaseSensitive(task, "content");
-      if (curContent == NULL) {
-        return NULL;
-      }
-      if (!cJSON_IsString(curContent)) {
-        return NULL;
-      }
-
-      cJSON *curId = cJSON_GetObjectItemCaseSensitive(task, "id");
-      if (curId == NULL) {
-        return NULL;
-      }
-      // curId is a inputted as a string for some reason
-      if (!cJSON_IsString(curId)) {
-        return NULL;
-      }
-
-      if (curPriority->valueint == target) {
-        cJSON *newTask = cJSON_CreateObject();
-        cJSON_AddItemToObject(newTask, "priority",
-                              cJSON_CreateNumber(curPriority->valueint));
-        cJSON_AddStringToObject(newTask, "content", curContent->valuestring);
-
-        // The id is a string because why should we bother going to an int and
-        // then back?
-        cJSON_AddStringToObject(newTask, "id", curId->valuestring);
-        cJSON_AddItemToArray(tasksJson, newTask);
-      }
+  cJSON_ArrayForEach(task, json) {
+    int priority = repairTask(task);
+    priorities[position++] = priority;
+    if (priority != 0) {
+      starts[4 - priority + 1]++;
+    }
+  }
+  for (int i = 1; i < 5; i++) {
+    starts[i] += starts[i - 1];
+  }
+  int ends[4];
+  memcpy(ends, starts + 1, sizeof(ends));
+
+  int sortedLength = starts[4];
+  position = 0;
+  cJSON_ArrayForEach(task, json) {
+    int priority = priorities[position];
+    if (priority != 0) {
+      sortedTasks[starts[4 - priority]++] = (struct sortingTask){
+          .task = task, .order = getTaskOrder(task), .position = position};
     }
-    target -= 1;
+    position++;
+  }
+  free(priorities);
+  for (int i = 0; i < 4; i++) {
+    int start = i == 0 ? 0 : ends[i - 1];
+    qsort(sortedTasks + start, ends[i] - start, sizeof(struct sortingTask),
+          compareTaskOrder);
+  }
+
+  // Moving the tasks over instead of copying them saves an allocation per
+  // field
+  for (int i = 0; i < sortedLength; i++) {
+    cJSON_AddItemToArray(tasksJson,
+                         cJSON_DetachItemViaPointer(json, sortedTasks[i].task));
   }
+  free(sortedTasks);
 
   return tasksJson;
 }
 
-void projectPanel(struct curlArgs curlArgs, int row, int col) {
+void projectPanel(struct curlArgs curlArgs, int row, int col,
+                  cJSON *localTasks, char *viewKey) {
   PANEL *projectPanel;
   WINDOW *projectWindow;
 
-  // Query for list of currently open tasks
-  char *tasksUrl = combineString(BASE_REST_URL, "tasks");
-  cJSON *unsortedTasksJson = makeRequest(curlArgs);
-
-  // Get menu
-  cJSON *tasksJson = sortTasks(unsortedTasksJson);
-  int tasksLength = cJSON_GetArraySize(tasksJson);
-  MENU *tasksMenu = renderMenuFromJson(tasksJson, "content");
-  int menuCol = 1;
-  int *menuRow = &tasksLength;
-  int res = set_menu_format(tasksMenu, *menuRow, menuCol);
-
-  projectWindow = newwin(row, col, 0, 0);
+  struct taskView *view = takeCachedView(viewKey);
+  if (view == NULL) {
+    view = createTaskView(curlArgs, row, col, localTasks);
+    if (view == NULL) {
+      return;
+    }
+  } else if (view->list.height != row - 1 || view->list.width != col) {
+    // The terminal was resized since it was cached
+    handleTaskResize(view);
+  }
+  view->curlArgs = curlArgs;
+  projectWindow = view->list.window;
   projectPanel = new_panel(projectWindow);
-  set_menu_mark(tasksMenu, NULL);
 
-  // Render
-  clear();
+  // Render. A cached view still has its rows drawn in its window, it just
+  // needs to be put back on screen.
+  touchwin(projectWindow);
+  touchwin(view->status);
+  update_panels();
+  wnoutrefresh(projectWindow);
+  wnoutrefresh(view->status);
+  presentFrame();
+
+  // Runs until handleTaskKey stops it, which means going back to the
+  // projects menu
+  struct eventView projectsView =
+      setEventView((struct eventView){.onKey = handleTaskKey,
+                                      .onResize = handleTaskResize,
+                                      .onFrame = presentTaskFrame,
+                                      .data = view});
+  setRefreshView(view, viewKey);
+  runEventLoop();
+  setRefreshView(NULL, NULL);
+  setEventView(projectsView);
+  // A half typed task or search isn't kept along with the view
+  cancelTaskPrompt(view);
+
+  // Changes still in flight need the view to finish (or be undone), so wait
+  // for them before it goes
+  if (view->pendingMutations > 0) {
+    showTaskNotice(view, "Saving changes...");
+    waitForPending(&view->pendingMutations);
+  }
+  if (view->noticeTimer != -1) {
+    cancelTimer(view->noticeTimer);
+    view->noticeTimer = -1;
+  }
+
+  del_panel(projectPanel);
   update_panels();
-  post_menu(tasksMenu);
-  wrefresh(projectWindow);
+  touchwin(stdscr);
   refresh();
 
-  // Event loop (ish?). Think of 'break' as going back to the projects menu.
-  int getchChar;
-  while ((getchChar = getch()) != 'q') {
-    if (getchChar == KEY_DOWN || getchChar == 'j') {
-      menu_driver(tasksMenu, REQ_DOWN_ITEM);
-    } else if (getchChar == KEY_UP || getchChar == 'k') {
-      menu_driver(tasksMenu, REQ_UP_ITEM);
-    } else if (getchChar == 'h') {
-      break;
-    } else if (getchChar == 'p') {
-      ITEM **newItems = closeTask(tasksJson, tasksMenu, curlArgs);
-      if (newItems == NULL) {
-        break;
-      }
-      setItemsAndRepostMenu(tasksMenu, newItems);
-      refresh();
-    } else if (getchChar == 'o') {
-      if (!reopenTask(tasksJson, tasksMenu, curlArgs)) {
-        break;
-      };
-      post_menu(tasksMenu);
-      refresh();
-    } else if (getchChar == 'i') {
-      ITEM **newItems = createTask(curlArgs, tasksJson);
-      if (!newItems) {
-        displayMessage("Creating new task failed. Press any key to return to "
-                       "the main menu.");
-        return;
-      }
+  cacheTaskView(viewKey, view);
+}
 
-      setItemsAndRepostMenu(tasksMenu, newItems);
-      refresh();
-    } else if (getchChar == 'd') {
-      ITEM **newItems = deleteTask(tasksJson, curlArgs, tasksMenu);
+// Builds a view around tasks, which it takes, already sorted. NULL is no
+// tasks.
+static struct taskView *buildTaskView(cJSON *tasks, struct curlArgs curlArgs,
+                                      int row, int col) {
+  struct taskView *view = calloc(1, sizeof(struct taskView));
+  if (view == NULL) {
+    cJSON_Delete(tasks);
+    return NULL;
+  }
+  view->json = tasks;
+  if (view->json == NULL) {
+    view->json = cJSON_CreateArray();
+  }
 
-      // If deleteTask returns NULL, it doesn't necesarrily mean that anything
-      // failed. It just means that the user might've closed out of it.
-      if (newItems) {
-        setItemsAndRepostMenu(tasksMenu, newItems);
-      }
-      refresh();
+  view->curlArgs = curlArgs;
+  view->noticeTimer = -1;
+  view->tree = buildTaskTree(view->json);
+  if (view->tree == NULL) {
+    displayMessage("Something went wrong when building the list of tasks. "
+                   "Press any key to return to the projects menu.");
+    cJSON_Delete(view->json);
+    free(view);
+    return NULL;
+  }
+  // The list takes everything but the last line, which is for the search
+  // prompt
+  view->list = (struct listView){.window = newwin(row - 1, col, 0, 0),
+                                 .top = view->tree->firstVisible,
+                                 .cursor = -1,
+                                 .cursorRow = 0,
+                                 .height = row - 1,
+                                 .width = col};
+  if (!allocTaskRows(&view->list)) {
+    displayMessage("Something went wrong when building the list of tasks. "
+                   "Press any key to return to the projects menu.");
+    delwin(view->list.window);
+    freeTaskTree(view->tree);
+    cJSON_Delete(view->json);
+    free(view);
+    return NULL;
+  }
+  view->status = newwin(1, col, row - 1, 0);
+  keypad(view->list.window, TRUE);
+  keypad(view->status, TRUE);
+  // Scrolling can use the terminal's own line insert/delete, and there's no
+  // point moving the hardware cursor around after every update
+  idlok(view->list.window, TRUE);
+  leaveok(view->list.window, TRUE);
+  settleTaskCursor(view);
+  drawTaskRows(view, 0, view->list.height);
+  return view;
+}
+
+struct taskView *createTaskView(struct curlArgs curlArgs, int row, int col,
+                                cJSON *localTasks) {
+  // Fetched tasks come back already sorted, off the UI thread. Local ones
+  // belong to someone else, and sortTasks takes the tasks it's given.
+  cJSON *tasks = NULL;
+  if (localTasks != NULL) {
+    cJSON *unsortedTasksJson = cJSON_Duplicate(localTasks, true);
+    tasks = sortTasks(unsortedTasksJson);
+    cJSON_Delete(unsortedTasksJson);
+  } else {
+    int backedOut;
+    tasks = makeTasksRequest(curlArgs, &backedOut);
+    if (backedOut) {
+      return NULL;
+    }
+  }
+  return buildTaskView(tasks, curlArgs, row, col);
+}
+
+void freeTaskView(struct taskView *view) {
+  // Nothing's in flight by now, so the only action left is one that's asking,
+  // and calling it off turns bracketed paste back off if it needs to
+  cancelTaskPrompt(view);
+  delwin(view->list.window);
+  delwin(view->status);
+  freeTaskRows(&view->list);
+  freeTaskTree(view->tree);
+  cJSON_Delete(view->json);
+  free(view);
+}
+
+// What cJSON allocates for items and their strings, without the allocator's
+// own overhead
+static size_t jsonBytes(const cJSON *item) {
+  size_t bytes = 0;
+  for (; item != NULL; item = item->next) {
+    bytes += sizeof(cJSON);
+    if (item->valuestring != NULL) {
+      bytes += strlen(item->valuestring) + 1;
+    }
+    if (item->string != NULL && !(item->type & cJSON_StringIsConst)) {
+      bytes += strlen(item->string) + 1;
+    }
+    bytes += jsonBytes(item->child);
+  }
+  return bytes;
+}
+
+size_t taskViewBytes(struct taskView *view) {
+  struct taskTree *tree = view->tree;
+  struct listView *list = &view->list;
+  size_t bytes = sizeof(struct taskView) + jsonBytes(view->json);
+  bytes += sizeof(struct taskTree) +
+           tree->capacity * sizeof(struct taskNode) +
+           tree->ids.capacity * (sizeof(char *) + sizeof(int));
+  bytes += list->rowsLength * (sizeof(struct listRow) + list->rowBytes);
+  // Windows keep a line struct and a cell per column for every row
+  bytes += (list->height + 1) * (list->width * sizeof(chtype) + 64);
+
+  return bytes;
+}
+
+static void unlinkCachedView(struct cachedView *cached) {
+  if (cached->prev == NULL) {
+    viewCache.first = cached->next;
+  } else {
+    cached->prev->next = cached->next;
+  }
+  if (cached->next == NULL) {
+    viewCache.last = cached->prev;
+  } else {
+    cached->next->prev = cached->prev;
+  }
+  viewCache.bytes -= cached->bytes;
+  viewCache.length--;
+}
+
+struct taskView *takeCachedView(const char *key) {
+  struct cachedView *cached = viewCache.first;
+  while (cached != NULL && strcmp(cached->key, key) != 0) {
+    cached = cached->next;
+  }
+  if (cached == NULL) {
+    viewCache.misses++;
+    return NULL;
+  }
+
+  unlinkCachedView(cached);
+  struct taskView *view = cached->view;
+  // Changes to its project made from another view (or a filter that's out of
+  // date) mean starting over
+  if (cached->version != viewVersion(key)) {
+    freeTaskView(view);
+    view = NULL;
+    viewCache.misses++;
+  } else {
+    viewCache.hits++;
+  }
+  free(cached->key);
+  free(cached);
+  return view;
+}
+
+void cacheTaskView(const char *key, struct taskView *view) {
+  if (view->stale) {
+    freeTaskView(view);
+    return;
+  }
+
+  // Kept the way it'd be opened again, so a search that was left narrowing
+  // the list is put back to the whole list, cursor and all
+  if (view->tree->filtered) {
+    resetVisibleTasks(view->tree);
+    settleTaskCursor(view);
+    drawTaskRows(view, 0, view->list.height);
+  }
+  werase(view->status);
+
+  struct cachedView *cached = malloc(sizeof(struct cachedView));
+  char *keyCopy = strdup(key);
+  if (cached == NULL || keyCopy == NULL) {
+    free(cached);
+    free(keyCopy);
+    freeTaskView(view);
+    return;
+  }
+  *cached = (struct cachedView){.key = keyCopy,
+                                .view = view,
+                                .bytes = taskViewBytes(view),
+                                .version = viewVersion(key),
+                                .next = viewCache.first};
+  if (viewCache.first == NULL) {
+    viewCache.last = cached;
+  } else {
+    viewCache.first->prev = cached;
+  }
+  viewCache.first = cached;
+  viewCache.bytes += cached->bytes;
+  viewCache.length++;
+
+  while (viewCache.bytes > viewCache.budget && viewCache.last != NULL) {
+    struct cachedView *oldest = viewCache.last;
+    unlinkCachedView(oldest);
+    freeTaskView(oldest->view);
+    free(oldest->key);
+    free(oldest);
+    viewCache.evictions++;
+  }
+}
+
+void freeViewCache(void) {
+  while (viewCache.first != NULL) {
+    struct cachedView *cached = viewCache.first;
+    unlinkCachedView(cached);
+    freeTaskView(cached->view);
+    free(cached->key);
+    free(cached);
+  }
+}
+
+void handleProjectsKey(int key, void *data) {
+  struct projectsView *projectsView = (struct projectsView *)data;
+  MENU *projectsMenu = projectsView->menu;
+
+  if (key == 'q') {
+    stopEventLoop();
+    return;
+  } else if (key == 'j') {
+    menu_driver(projectsMenu, REQ_DOWN_ITEM);
+    schedulePrefetch(projectsView);
+  } else if (key == KEY_UP || key == 'k') {
+    menu_driver(projectsMenu, REQ_UP_ITEM);
+    schedulePrefetch(projectsView);
+  } else if (key == 'l') {
+    // Find project ID, and call projectPanel with that project ID in a
+    // curlArgs struct
+    cJSON *currentItemJson =
+        getCurrentItemJson(projectsMenu, projectsView->json);
+    if (currentItemJson == NULL) {
+      displayMessage("Something went wrong when trying to access the current "
+                     "item of the Ncurses menu. Press any key to quit.");
+      stopEventLoop();
+      return;
+    }
+    cJSON *projectIDJson =
+        cJSON_GetObjectItemCaseSensitive(currentItemJson, "id");
+    if (projectIDJson == NULL) {
+      displayMessage("JSON for project ID is null. Press any key to quit.");
+      stopEventLoop();
+      return;
+    }
+
+    // A refresh can take the project out of projectsView->json while it's
+    // open, id and all, so the panel gets a copy of its own
+    char *projectID = strdup(projectIDJson->valuestring);
+    if (projectID == NULL || !awaitPrefetch(projectID)) {
+      free(projectID);
+      requestFrame();
+      return;
+    }
+    char *tasksUrl;
+    cJSON *localTasks = NULL;
+    if (strncmp(projectID, FILTER_VIEW_ID_PREFIX,
+                strlen(FILTER_VIEW_ID_PREFIX)) == 0) {
+      // Filters run against the cache, so there's nothing to fetch
+      int filterViewIndex = atoi(projectID + strlen(FILTER_VIEW_ID_PREFIX));
+      localTasks =
+          getFilterResults(&projectsView->filterViews[filterViewIndex]);
+      tasksUrl = combineString(BASE_REST_URL, "tasks");
+    } else {
+      tasksUrl = combineString(BASE_REST_URL, "tasks/?project_id=");
+      tasksUrl = combineString(tasksUrl, projectID);
+    }
+
+    struct curlArgs projectPanelCurlArgs = {.curl = projectsView->curl,
+                                            .headers = projectsView->headers,
+                                            .method = "GET",
+                                            .url = tasksUrl};
+    projectPanel(projectPanelCurlArgs, projectsView->row, projectsView->col,
+                 localTasks, projectID);
+
+    // Scuffed fix for projects list not loading after exiting from
+    // project panel
+    menu_driver(projectsMenu, REQ_NEXT_ITEM);
+    menu_driver(projectsMenu, REQ_PREV_ITEM);
+
+    // Resizes while the project was open only reached its view
+    if (projectsView->row != LINES || projectsView->col != COLS) {
+      handleProjectsResize(projectsView);
+    }
+
+    // Once projectPanel returns, the user has exited the panel.
+    free(tasksUrl);
+    free(projectID);
+  }
+  requestFrame();
+}
+
+void presentProjectsFrame(void *data) {
+  struct projectsView *projectsView = (struct projectsView *)data;
+  wnoutrefresh(menu_win(projectsView->menu));
+  presentFrame();
+}
+
+void handleProjectsResize(void *data) {
+  struct projectsView *projectsView = (struct projectsView *)data;
+  getmaxyx(stdscr, projectsView->row, projectsView->col);
+
+  // The format can only change while the menu isn't posted
+  unpost_menu(projectsView->menu);
+  set_menu_format(projectsView->menu,
+                  projectsView->row > 0 ? projectsView->row : 1, 1);
+  post_menu(projectsView->menu);
+  requestFrame();
+}
+
+void handleTaskKey(int key, void *data) {
+  struct taskView *view = (struct taskView *)data;
+
+  // While an action's asking, or a search is being typed, every key is part
+  // of it
+  if (view->asking != NULL) {
+    answerTaskAction(view, key);
+    requestFrame();
+    return;
+  }
+  if (view->searching != NULL) {
+    answerTaskSearch(view, key);
+    requestFrame();
+    return;
+  }
+
+  // Holding j down sends keys faster than a slow terminal can draw them, so
+  // they're only counted here. Anything else needs the cursor where it's
+  // going first.
+  if (key == KEY_DOWN || key == 'j' || key == KEY_UP || key == 'k') {
+    view->pendingMove += key == KEY_DOWN || key == 'j' ? 1 : -1;
+    requestFrame();
+    return;
+  }
+  if (view->pendingMove != 0) {
+    moveTaskCursor(view, view->pendingMove);
+    view->pendingMove = 0;
+  }
+
+  if (key == 'q' || key == 'h') {
+    stopEventLoop();
+    return;
+  } else if (key == KEY_NPAGE) {
+    pageTaskCursor(view, 1);
+  } else if (key == KEY_PPAGE) {
+    pageTaskCursor(view, -1);
+  } else if (key == 'g' || key == KEY_HOME) {
+    jumpTaskCursor(view, view->tree->firstVisible);
+  } else if (key == 'G' || key == KEY_END) {
+    jumpTaskCursor(view, view->tree->lastVisible);
+  } else if (key == 'p') {
+    startTaskAction(view, MUTATION_CLOSE);
+  } else if (key == 'o') {
+    startTaskAction(view, MUTATION_REOPEN);
+  } else if (key == 'i') {
+    startTaskAction(view, MUTATION_CREATE);
+  } else if (key == 'd') {
+    startTaskAction(view, MUTATION_DELETE);
+  } else if (key == 'z') {
+    // Collapse or expand the subtasks of the current task. Only the rows
+    // from the cursor down change.
+    int node = view->list.cursor;
+    if (node == -1 || view->tree->filtered ||
+        view->tree->nodes[node].firstChild == -1) {
+      return;
+    }
+    toggleTaskCollapsed(view->tree, node);
+    forgetTaskRow(&view->list, node);
+    drawTaskRows(view, view->list.cursorRow, view->list.height);
+  } else if (key == '/') {
+    startTaskSearch(view);
+  }
+  requestFrame();
+}
+
+void presentTaskFrame(void *data) {
+  struct taskView *view = (struct taskView *)data;
+  if (view->pendingMove != 0) {
+    moveTaskCursor(view, view->pendingMove);
+    view->pendingMove = 0;
+  }
+  runTaskSearch(view);
+  wnoutrefresh(view->list.window);
+  if (view->asking != NULL || view->searching != NULL) {
+    drawTaskPrompt(view);
+  } else {
+    drawFrameStats(view->status);
+  }
+  wnoutrefresh(view->status);
+  presentFrame();
+}
+
+void handleTaskResize(void *data) {
+  struct taskView *view = (struct taskView *)data;
+  struct listView *list = &view->list;
+  // The list always keeps a row, and the status line goes under it
+  int height = LINES > 2 ? LINES - 1 : 1;
+  int width = COLS > 1 ? COLS : 1;
+  int oldHeight = list->height;
+  int oldWidth = list->width;
+  int oldTop = list->top;
+
+  // Rows are formatted to the width, so a narrower list can keep them (they're
+  // cut off when drawn), but a wider one needs them formatted again. The cache
+  // only has to be replaced if that, or the height, outgrew it.
+  if (width > oldWidth || height + 2 * LIST_ROW_MARGIN > list->rowsLength) {
+    struct listView resized = *list;
+    resized.height = height;
+    resized.width = width;
+    if (!allocTaskRows(&resized)) {
+      // Stay at the old size rather than draw past the cache
+      return;
+    }
+    freeTaskRows(list);
+    list->rows = resized.rows;
+    list->rowsLength = resized.rowsLength;
+    list->rowBytes = resized.rowBytes;
+  }
+
+  wresize(list->window, height, width);
+  wresize(view->status, 1, width);
+  mvwin(view->status, height, 0);
+  list->height = height;
+  list->width = width;
+
+  // A shorter list might have lost the cursor off the bottom, in which case
+  // it stays on the last row
+  struct taskNode *nodes = view->tree->nodes;
+  for (; list->cursorRow >= height && list->top != -1; list->cursorRow--) {
+    list->top = nodes[list->top].nextVisible;
+  }
+  settleTaskCursor(view);
+  if (list->top != oldTop || width > oldWidth) {
+    drawTaskRows(view, 0, height);
+  } else if (height > oldHeight) {
+    drawTaskRows(view, oldHeight, height);
+  }
+  werase(view->status);
+  if (view->asking != NULL || view->searching != NULL) {
+    drawTaskPrompt(view);
+  } else {
+    drawFrameStats(view->status);
+  }
+  requestFrame();
+}
+
+// Adds an item_add command for a task called content to commands, and returns
+// the task the way sortTasks would have it (going by its temp_id until the
+// server answers with the real id). Returns NULL on failure.
+static cJSON *addCreateCommand(cJSON *commands, const char *content) {
+  cJSON *newTask = cJSON_CreateObject();
+  if (!cJSON_AddItemToArray(commands, newTask) ||
+      !cJSON_AddStringToObject(newTask, "type", "item_add")) {
+    return NULL;
+  }
+
+  // Create and add uuids
+  uuid_t binuuid;
+  char tmp_uuid[37];
+  char uuid[37];
+  uuid_generate_random(binuuid);
+  uuid_unparse(binuuid, tmp_uuid);
+  uuid_generate_random(binuuid);
+  uuid_unparse(binuuid, uuid);
+  if (!cJSON_AddStringToObject(newTask, "temp_id", tmp_uuid) ||
+      !cJSON_AddStringToObject(newTask, "uuid", uuid)) {
+    return NULL;
+  }
+
+  cJSON *args = cJSON_CreateObject();
+  if (!cJSON_AddItemToObject(newTask, "args", args) ||
+      !cJSON_AddStringToObject(args, "content", content)) {
+    return NULL;
+  }
+
+  cJSON *newTaskJson = cJSON_CreateObject();
+  cJSON_AddItemToObject(newTaskJson, "priority", cJSON_CreateNumber(1));
+  cJSON_AddStringToObject(newTaskJson, "content", content);
+  cJSON_AddStringToObject(newTaskJson, "id", tmp_uuid);
+  return newTaskJson;
+}
+
+// Sends one request for action creating tasksLength tasks, named after lines,
+// and puts them in view->json. Returns 0 if the request couldn't be started,
+// in which case nothing's changed.
+static int createTaskBatch(struct taskAction *action, char **lines,
+                           int tasksLength) {
+  struct taskView *view = action->view;
+  struct curlArgs curlArgs = view->curlArgs;
+  cJSON *postFieldsJson = cJSON_CreateObject();
+  cJSON *commands = cJSON_AddArrayToObject(postFieldsJson, "commands");
+  cJSON *tasks[CREATE_BATCH];
+  int created = 0;
+  while (commands != NULL && created < tasksLength) {
+    tasks[created] = addCreateCommand(commands, lines[created]);
+    if (tasks[created] == NULL) {
+      break;
+    }
+    created++;
+  }
+
+  struct pendingMutation *mutation = NULL;
+  char *postFields = NULL;
+  if (created == tasksLength &&
+      (postFields = cJSON_PrintUnformatted(postFieldsJson)) != NULL) {
+    struct curl_slist *createTaskHeaders = NULL;
+    createTaskHeaders =
+        curl_slist_append(createTaskHeaders, curlArgs.headers->data);
+    createTaskHeaders =
+        curl_slist_append(createTaskHeaders, "Content-Type: application/json");
+    struct curlArgs createTaskCurlArgs = {.curl = curlArgs.curl,
+                                          .headers = createTaskHeaders,
+                                          .method = "POST",
+                                          .url = BASE_SYNC_URL,
+                                          .postFields = postFields};
+
+    // The first task's temp_id stands in for the batch
+    mutation = startMutation(view, MUTATION_CREATE,
+                             getJsonValue(tasks[0], "id"), tasks, tasksLength,
+                             createTaskCurlArgs);
+    curl_slist_free_all(createTaskHeaders);
+  }
+  free(postFields);
+  cJSON_Delete(postFieldsJson);
+  if (mutation != NULL) {
+    mutation->action = action;
+    action->sending++;
+  }
+
+  // Searchable under their temp_id until the cache has them
+  for (int i = 0; i < created; i++) {
+    if (mutation == NULL) {
+      cJSON_Delete(tasks[i]);
+    } else {
+      cJSON_AddItemToArray(view->json, tasks[i]);
+      searchIndexAdd(taskCache.search, tasks[i]);
+    }
+  }
+  return mutation != NULL;
+}
+
+ITEM **createItemsFromJson(cJSON *json, int customLength, char *query) {
+  ITEM **newItems = (ITEM **)malloc(customLength * sizeof(struct ITEM *));
+  int itemsLength = cJSON_GetArraySize(json);
+
+  for (int i = 0; i < itemsLength; i++) {
+    cJSON *curItem = cJSON_GetArrayItem(json, i);
+    if (curItem == NULL) {
+      return NULL;
+    }
+    cJSON *curContent = cJSON_GetObjectItemCaseSensitive(curItem, query);
+    if (curContent == NULL) {
+      return NULL;
+    }
+
+    // If curPriority is NULL, we're rendering the projects menu
+    cJSON *curPriority = cJSON_GetObjectItemCaseSensitive(curItem, "priority");
+
+    if (curPriority == NULL) {
+      newItems[i] = new_item(curContent->valuestring, NULL);
+    } else {
+      cJSON *curId = cJSON_GetObjectItemCaseSensitive(curItem, "id");
+      if (!curId) {
+        return NULL;
+      }
+
+      if (!cJSON_IsString(curId)) {
+        return NULL;
+      }
+
+      // No idea why we need to do this for the priority field...
+      newItems[i] = new_item(curContent->valuestring, cJSON_Print(curPriority));
+
+      // Add metadata to userptr (DON'T FORGET TO FREE() THIS)
+      struct taskMetaData *newTaskMetaData =
+          (struct taskMetaData *)malloc(sizeof(struct taskMetaData *));
+      newTaskMetaData->content = curContent->string;
+      newTaskMetaData->priority = curPriority->valueint;
+      newTaskMetaData->id = curId->valuestring;
+      set_item_userptr(newItems[i], newTaskMetaData);
+    }
+  }
+
+  return newItems;
+}
+
+char *getJsonValue(cJSON *json, char *key) {
+  cJSON *keyValuePair = cJSON_GetObjectItemCaseSensitive(json, key);
+  if (keyValuePair == NULL) {
+    displayMessage("Something went wrong when closing the task. Press any "
+                   "key to return to the projects menu. (getJsonValue 1)");
+    return NULL;
+  }
+  char *value = keyValuePair->valuestring;
+  if (value == NULL) {
+    displayMessage("Something went wrong when closing the task. Press any "
+                   "key to return to the projects menu. (getJsonValue 2)");
+    return NULL;
+  }
+
+  return value;
+}
+
+int getJsonIntValue(cJSON *json, char *key) {
+  cJSON *keyValuePair = cJSON_GetObjectItemCaseSensitive(json, key);
+  if (keyValuePair == NULL) {
+    displayMessage("Something went wrong when closing the task. Press any "
+                   "key to return to the projects menu. (getJsonIntValue 1)");
+    return -1;
+  }
+  return keyValuePair->valueint;
+}
+
+cJSON *createJsonDueCommand(char *string, char *itemId) {
+  uuid_t binuuid;
+  char uuid[37];
+  uuid_generate_random(binuuid);
+  uuid_unparse(binuuid, uuid);
+
+  // Everything goes in as soon as it's made, so deleting postFieldsJson
+  // frees whatever got made
+  cJSON *postFieldsJson = cJSON_CreateObject();
+  cJSON *commands = cJSON_AddArrayToObject(postFieldsJson, "commands");
+  cJSON *command = cJSON_CreateObject();
+  cJSON *args = NULL;
+  cJSON *due = NULL;
+  if (!cJSON_AddItemToArray(commands, command)) {
+    cJSON_Delete(command);
+    cJSON_Delete(postFieldsJson);
+    return NULL;
+  }
+  // Setting the due date's string is what moves it along, and so closes or
+  // reopens a recurring task
+  if (!cJSON_AddStringToObject(command, "type", "item_update") ||
+      !cJSON_AddStringToObject(command, "uuid", uuid) ||
+      (args = cJSON_AddObjectToObject(command, "args")) == NULL ||
+      !cJSON_AddStringToObject(args, "id", itemId) ||
+      (due = cJSON_AddObjectToObject(args, "due")) == NULL ||
+      !cJSON_AddStringToObject(due, "string", string)) {
+    cJSON_Delete(postFieldsJson);
+    return NULL;
+  }
+  return postFieldsJson;
+}
+
+// Takes action off its view's list and frees it. It's done.
+static void freeTaskAction(struct taskAction *action) {
+  struct taskAction **link = &action->view->actions;
+  while (*link != action) {
+    link = &(*link)->next;
+  }
+  *link = action->next;
+  if (action->view->asking == action) {
+    action->view->asking = NULL;
+  }
+  if (action->type == MUTATION_CREATE) {
+    gapBufferFree(&action->input);
+  }
+  free(action->id);
+  free(action);
+}
+
+// Finds the task action is about, with the cursor on it since that's what a
+// row is taken off by. Returns -1 if it's gone.
+static int findActionTask(struct taskAction *action) {
+  struct taskView *view = action->view;
+  int node = stringMapGet(&view->tree->ids, action->id);
+  if (node != -1 && node != view->list.cursor) {
+    jumpTaskCursor(view, node);
+  }
+  return node != -1 && node == view->list.cursor ? node : -1;
+}
+
+// Each line of what was typed is a task, so a pasted list makes one each
+static void sendNewTasks(struct taskAction *action) {
+  struct taskView *view = action->view;
+  char *text = gapBufferString(&action->input);
+  if (text == NULL) {
+    showTaskNotice(view, "Couldn't send the request to create the task.");
+    return;
+  }
+
+  // Blank lines (a trailing newline, say) don't make tasks
+  char **lines = NULL;
+  int linesLength = 0;
+  char *savePointer = NULL;
+  for (char *line = strtok_r(text, "\r\n", &savePointer); line != NULL;
+       line = strtok_r(NULL, "\r\n", &savePointer)) {
+    if (strspn(line, " ") == strlen(line)) {
+      continue;
+    }
+    char **grown = realloc(lines, (linesLength + 1) * sizeof(char *));
+    if (grown == NULL) {
+      linesLength = -1;
+      break;
+    }
+    lines = grown;
+    lines[linesLength++] = line;
+  }
+
+  int created = 0;
+  while (created < linesLength) {
+    int batch = linesLength - created < CREATE_BATCH ? linesLength - created
+                                                     : CREATE_BATCH;
+    if (!createTaskBatch(action, lines + created, batch)) {
+      break;
+    }
+    created += batch;
+  }
+  if (created < linesLength || linesLength == -1) {
+    showTaskNotice(view, "Couldn't send the request to create the task.");
+  }
+  free(lines);
+  free(text);
+
+  // One task can go in as a row; many are cheaper to build the tree again for
+  if (created == 1) {
+    // cJSON keeps the last item as the first one's prev
+    if (!insertTaskRow(view, view->json->child->prev)) {
+      reloadTaskRows(view);
+    }
+  } else if (created > 1) {
+    reloadTaskRows(view);
+  }
+}
+
+// Closing and reopening set the due date, through the Sync API. Nothing on the
+// list changes for a reopen, and the cache is updated once the server agrees.
+static void sendDueChange(struct taskAction *action) {
+  struct taskView *view = action->view;
+  int closing = action->type == MUTATION_CLOSE;
+  int node = findActionTask(action);
+  cJSON *postFieldsJson = createJsonDueCommand(
+      closing ? "every day starting tomorrow" : "every day starting today",
+      action->id);
+  char *postFields =
+      postFieldsJson == NULL ? NULL : cJSON_PrintUnformatted(postFieldsJson);
+
+  struct pendingMutation *mutation = NULL;
+  if (node != -1 && postFields != NULL) {
+    struct curl_slist *headers = NULL;
+    headers = curl_slist_append(headers, view->curlArgs.headers->data);
+    headers = curl_slist_append(headers, "Content-Type: application/json");
+    headers = curl_slist_append(headers, "Accept: application/json");
+    struct curlArgs args = {.curl = view->curlArgs.curl,
+                            .headers = headers,
+                            .method = "POST",
+                            .url = BASE_SYNC_URL,
+                            .postFields = postFields};
+    cJSON *task = view->tree->nodes[node].json;
+    mutation = startMutation(view, action->type, action->id, &task, 1, args);
+    curl_slist_free_all(headers);
+  }
+  cJSON_Delete(postFieldsJson);
+  free(postFields);
+  if (mutation == NULL) {
+    showTaskNotice(view, closing
+                             ? "Couldn't send the request to close the task."
+                             : "Couldn't send the request to reopen the task.");
+    return;
+  }
+  mutation->action = action;
+  action->sending++;
+
+  // The row goes without waiting for the server. Subtasks of the completed
+  // task just move up a level.
+  if (closing) {
+    removeTaskRow(view, 1);
+  }
+}
+
+// Todoist deletes subtasks along with their parent, so the whole subtree goes
+static void sendDeletion(struct taskAction *action) {
+  struct taskView *view = action->view;
+  int root = findActionTask(action);
+  if (root == -1) {
+    showTaskNotice(view, "That task's gone already.");
+    return;
+  }
+
+  struct taskNode *nodes = view->tree->nodes;
+  int tasksLength = 0;
+  for (int cur = root; cur != -1; cur = nextTaskInSubtree(nodes, root, cur)) {
+    tasksLength++;
+  }
+  cJSON **tasks = malloc(tasksLength * sizeof(cJSON *));
+  char *url = combineString(BASE_REST_URL "tasks/", action->id);
+  struct pendingMutation *mutation = NULL;
+  if (tasks != NULL && url != NULL) {
+    tasksLength = 0;
+    for (int cur = root; cur != -1;
+         cur = nextTaskInSubtree(nodes, root, cur)) {
+      tasks[tasksLength++] = nodes[cur].json;
+    }
+    struct curlArgs args = {.curl = view->curlArgs.curl,
+                            .headers = view->curlArgs.headers,
+                            .method = "DELETE",
+                            .url = url,
+                            .postFields = view->curlArgs.postFields};
+    mutation = startMutation(view, MUTATION_DELETE, action->id, tasks,
+                             tasksLength, args);
+  }
+  free(url);
+  free(tasks);
+  if (mutation == NULL) {
+    showTaskNotice(view, "Couldn't send the request to delete the task.");
+    return;
+  }
+  mutation->action = action;
+  action->sending++;
+  removeTaskRow(view, 0);
+}
+
+// Moves action on from asking (or from nothing) to sending. It's done then
+// and there if nothing could be sent.
+static void sendTaskAction(struct taskAction *action) {
+  action->step = ACTION_SENDING;
+  switch (action->type) {
+  case MUTATION_CREATE:
+    sendNewTasks(action);
+    break;
+  case MUTATION_CLOSE:
+  case MUTATION_REOPEN:
+    sendDueChange(action);
+    break;
+  case MUTATION_DELETE:
+    sendDeletion(action);
+    break;
+  }
+  if (action->sending == 0) {
+    freeTaskAction(action);
+  }
+}
+
+void startTaskAction(struct taskView *view, enum mutationType type) {
+  // One question at a time
+  if (view->asking != NULL) {
+    return;
+  }
+  char *id = NULL;
+  if (type != MUTATION_CREATE) {
+    if (view->list.cursor == -1) {
+      return;
+    }
+    id = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(
+        view->tree->nodes[view->list.cursor].json, "id"));
+    if (id == NULL) {
+      return;
+    }
+    // Changes to the same task could reach the server out of order
+    if (findPendingMutation(view, id) != NULL) {
+      showTaskNotice(view, "That task is still being saved.");
+      return;
+    }
+  }
+
+  struct taskAction *action = calloc(1, sizeof(struct taskAction));
+  if (action == NULL) {
+    return;
+  }
+  action->type = type;
+  action->view = view;
+  action->id = id == NULL ? NULL : strdup(id);
+  action->lines = 1;
+  if ((id != NULL && action->id == NULL) ||
+      (type == MUTATION_CREATE && !gapBufferInit(&action->input, 64))) {
+    free(action->id);
+    free(action);
+    showTaskNotice(view, "Couldn't start that.");
+    return;
+  }
+  action->next = view->actions;
+  view->actions = action;
+
+  if (type == MUTATION_CLOSE || type == MUTATION_REOPEN) {
+    sendTaskAction(action);
+    return;
+  }
+  action->step = ACTION_ASKING;
+  view->asking = action;
+  if (type == MUTATION_CREATE) {
+    // Ask the terminal to mark pastes, so a pasted newline isn't taken as
+    // enter
+    setBracketedPaste(1);
+  }
+  requestFrame();
+}
+
+void answerTaskAction(struct taskView *view, int key) {
+  struct taskAction *action = view->asking;
+  struct gapBuffer *input = &action->input;
+  // 1 once it's been told to go ahead, -1 if it's been called off
+  int answer = 0;
+
+  if (action->type == MUTATION_DELETE) {
+    answer = key == 'y' ? 1 : -1;
+  } else if (key == KEY_PASTE_START || key == KEY_PASTE_END) {
+    action->pasting = key == KEY_PASTE_START;
+  } else if (action->pasting && (key == '\n' || key == '\r')) {
+    gapBufferInsert(input, "\n", 1);
+    action->lines++;
+  } else if (key == KEY_ENTER || key == '\n' || key == '\r') {
+    answer = 1;
+  } else if (key == 27) {
+    answer = -1;
+  } else if (key == KEY_BACKSPACE || key == 127 || key == 8) {
+    gapBufferDelete(input, -1);
+  } else if (key == KEY_DC) {
+    gapBufferDelete(input, 1);
+  } else if (key == KEY_LEFT) {
+    gapBufferMove(input, -1);
+  } else if (key == KEY_RIGHT) {
+    gapBufferMove(input, 1);
+  } else if (key == KEY_HOME || key == 1) {
+    while (input->gapStart > 0) {
+      gapBufferMove(input, -1);
+    }
+  } else if (key == KEY_END || key == 5) {
+    while (input->gapEnd < input->capacity) {
+      gapBufferMove(input, 1);
+    }
+  } else if (key == '\t') {
+    gapBufferInsert(input, " ", 1);
+  } else if (key >= ' ' && key <= 0xff) {
+    // UTF-8 comes in a byte at a time, and goes in the same way
+    char byte = (char)key;
+    gapBufferInsert(input, &byte, 1);
+  }
+  if (answer == 0) {
+    return;
+  }
+
+  view->asking = NULL;
+  if (action->type == MUTATION_CREATE) {
+    setBracketedPaste(0);
+  }
+  werase(view->status);
+  if (answer == 1) {
+    sendTaskAction(action);
+  } else {
+    freeTaskAction(action);
+  }
+}
+
+void cancelTaskPrompt(struct taskView *view) {
+  if (view->asking != NULL) {
+    answerTaskAction(view, 27);
+  }
+  if (view->searching != NULL) {
+    answerTaskSearch(view, 27);
+  }
+}
+
+void drawTaskPrompt(struct taskView *view) {
+  struct taskAction *action = view->asking;
+  int width = getmaxx(view->status);
+  werase(view->status);
+  if (action == NULL) {
+    mvwprintw(view->status, 0, 0, "/%s", view->searching->query);
+    return;
+  }
+  if (action->type == MUTATION_DELETE) {
+    waddnstr(view->status, "Delete this task and its subtasks? (y/n)",
+             width - 1);
+    return;
+  }
+
+  char label[48];
+  int labelLength =
+      action->lines > 1
+          ? snprintf(label, sizeof(label), "New tasks (%d lines): ",
+                     action->lines)
+          : snprintf(label, sizeof(label), "New task: ");
+  if (labelLength >= width) {
+    return;
+  }
+  waddstr(view->status, label);
+  // The line scrolls in what's left after the label
+  WINDOW *line = derwin(view->status, 1, width - labelLength, 0, labelLength);
+  if (line == NULL) {
+    return;
+  }
+  drawInputLine(line, 0, &action->input);
+  wmove(view->status, 0, labelLength + getcurx(line));
+  delwin(line);
+}
+
+static void freeMutation(struct pendingMutation *mutation) {
+  if (mutation->curl != NULL) {
+    curl_easy_cleanup(mutation->curl);
+  }
+  curl_slist_free_all(mutation->headers);
+  free(mutation->response.response);
+  free(mutation->tasks);
+  free(mutation->id);
+  free(mutation);
+}
+
+// Todoist's Sync API answers 200 even when a command fails, and says which
+// ones did in sync_status, so the status code isn't enough
+static int mutationSucceeded(CURL *curl, CURLcode result, cJSON *response) {
+  long httpCode = 0;
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpCode);
+  if (result != CURLE_OK || httpCode < 200 || httpCode >= 300) {
+    return 0;
+  }
+
+  cJSON *statuses = cJSON_GetObjectItemCaseSensitive(response, "sync_status");
+  cJSON *status = NULL;
+  cJSON_ArrayForEach(status, statuses) {
+    if (!cJSON_IsString(status) || strcmp(status->valuestring, "ok") != 0) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// A DELETE that went through but lost its answer on the way back gets a 404
+// when it's sent again. The task's gone either way.
+static int deletedAlready(struct pendingMutation *mutation, CURL *curl,
+                          CURLcode result) {
+  long httpCode = 0;
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpCode);
+  return mutation->type == MUTATION_DELETE && mutation->request.attempts > 0 &&
+         result == CURLE_OK && httpCode == 404;
+}
+
+// Makes the rest of the change now that the server has agreed: the cache (and
+// the search index with it), and the tasks that were only taken off the list.
+// Returns 0 if the response was missing something, in which case nothing has
+// changed.
+static int commitMutation(struct pendingMutation *mutation, cJSON *response) {
+  struct taskView *view = mutation->view;
+  char date[11];
+
+  switch (mutation->type) {
+  case MUTATION_CLOSE:
+    formatLocalDate(date, 1);
+    cacheSetTaskDue(mutation->id, date);
+    cJSON_Delete(cJSON_DetachItemViaPointer(view->json, mutation->tasks[0]));
+    break;
+  case MUTATION_REOPEN:
+    formatLocalDate(date, 0);
+    cacheSetTaskDue(mutation->id, date);
+    break;
+  case MUTATION_CREATE: {
+    cJSON *mapping =
+        cJSON_GetObjectItemCaseSensitive(response, "temp_id_mapping");
+    for (int i = 0; i < mutation->tasksLength; i++) {
+      if (cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(
+              mapping, getJsonValue(mutation->tasks[i], "id"))) == NULL) {
+        return 0;
+      }
+    }
+
+    for (int i = 0; i < mutation->tasksLength; i++) {
+      // The tree's id map points into the task's JSON, so the temp_id has to
+      // come out before the string changes
+      cJSON *task = mutation->tasks[i];
+      cJSON *idJson = cJSON_GetObjectItemCaseSensitive(task, "id");
+      char *id = cJSON_GetStringValue(
+          cJSON_GetObjectItemCaseSensitive(mapping, idJson->valuestring));
+      searchIndexRemove(taskCache.search, task);
+      int node = stringMapGet(&view->tree->ids, idJson->valuestring);
+      stringMapRemove(&view->tree->ids, idJson->valuestring);
+      cJSON_SetValuestring(idJson, id);
+      if (node != -1) {
+        stringMapPut(&view->tree->ids, idJson->valuestring, node);
+      }
+      cacheAddTask(cJSON_Duplicate(task, true));
+    }
+    break;
+  }
+  case MUTATION_DELETE:
+    for (int i = 0; i < mutation->tasksLength; i++) {
+      cJSON *task = mutation->tasks[i];
+      cacheRemoveTask(
+          cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(task, "id")));
+      cJSON_Delete(cJSON_DetachItemViaPointer(view->json, task));
+    }
+    break;
+  }
+  return 1;
+}
+
+static void rollbackMutation(struct pendingMutation *mutation) {
+  struct taskView *view = mutation->view;
+
+  switch (mutation->type) {
+  case MUTATION_CLOSE:
+    reloadTaskRows(view);
+    showTaskNotice(view, "Closing the task failed, so it's back on the list.");
+    break;
+  case MUTATION_REOPEN:
+    showTaskNotice(view, "Reopening the task failed.");
+    break;
+  case MUTATION_CREATE:
+    // The old tree still points at them until it's reloaded
+    for (int i = 0; i < mutation->tasksLength; i++) {
+      searchIndexRemove(taskCache.search, mutation->tasks[i]);
+      cJSON_DetachItemViaPointer(view->json, mutation->tasks[i]);
+    }
+    reloadTaskRows(view);
+    for (int i = 0; i < mutation->tasksLength; i++) {
+      cJSON_Delete(mutation->tasks[i]);
+    }
+    showTaskNotice(view, mutation->tasksLength == 1
+                             ? "Creating the task failed, so it's been taken "
+                               "off the list again."
+                             : "Creating the tasks failed, so they've been "
+                               "taken off the list again.");
+    break;
+  case MUTATION_DELETE:
+    reloadTaskRows(view);
+    showTaskNotice(view, "Deleting the task failed, so it's back on the list.");
+    break;
+  }
+}
+
+static void finishMutation(CURL *curl, CURLcode result, void *data) {
+  struct pendingMutation *mutation = (struct pendingMutation *)data;
+  struct taskView *view = mutation->view;
+
+  // Take it off the list first, so a reload doesn't count it as in flight
+  struct pendingMutation **link = &view->mutations;
+  while (*link != mutation) {
+    link = &(*link)->next;
+  }
+  *link = mutation->next;
+  view->pendingMutations--;
+
+  // DELETE answers with nothing at all, which doesn't parse
+  cJSON *response = cJSON_Parse(mutation->response.response);
+  if (!(mutationSucceeded(curl, result, response) ||
+        deletedAlready(mutation, curl, result)) ||
+      !commitMutation(mutation, response)) {
+    rollbackMutation(mutation);
+  }
+  cJSON_Delete(response);
+
+  // The last of an action's mutations finishes it
+  struct taskAction *action = mutation->action;
+  if (action != NULL && --action->sending == 0) {
+    freeTaskAction(action);
+  }
+  freeMutation(mutation);
+}
+
+// Turned away, it's sent again with nothing kept from the first time
+static void restartMutation(void *data) {
+  struct pendingMutation *mutation = (struct pendingMutation *)data;
+  mutation->response.size = 0;
+  mutation->response.response[0] = '\0';
+}
+
+struct pendingMutation *startMutation(struct taskView *view,
+                                      enum mutationType type, const char *id,
+                                      cJSON **tasks, int tasksLength,
+                                      struct curlArgs args) {
+  struct pendingMutation *mutation = calloc(1, sizeof(struct pendingMutation));
+  if (mutation == NULL) {
+    return NULL;
+  }
+  mutation->type = type;
+  mutation->view = view;
+  mutation->id = strdup(id);
+  mutation->tasks = malloc(tasksLength * sizeof(cJSON *));
+  mutation->tasksLength = tasksLength;
+  mutation->response.response = calloc(1, 1);
+  for (struct curl_slist *header = args.headers; header != NULL;
+       header = header->next) {
+    mutation->headers = curl_slist_append(mutation->headers, header->data);
+  }
+  // It may be sent more than once, and Todoist only acts on the first of
+  // those with the same request id. The Sync API's commands have uuids too.
+  uuid_t binuuid;
+  char requestId[sizeof("X-Request-Id: ") + 36];
+  uuid_generate_random(binuuid);
+  strcpy(requestId, "X-Request-Id: ");
+  uuid_unparse(binuuid, requestId + strlen(requestId));
+  mutation->headers = curl_slist_append(mutation->headers, requestId);
+
+  // Each change gets its own handle so they can be in flight together. The
+  // multi handle still shares connections between them.
+  mutation->curl = curl_easy_init();
+  if (mutation->id == NULL || mutation->tasks == NULL ||
+      mutation->response.response == NULL || mutation->curl == NULL) {
+    freeMutation(mutation);
+    return NULL;
+  }
+  memcpy(mutation->tasks, tasks, tasksLength * sizeof(cJSON *));
+
+  CURL *curl = mutation->curl;
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curlWriteHelper);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&mutation->response);
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, mutation->headers);
+  curl_easy_setopt(curl, CURLOPT_URL, args.url);
+  curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, args.method);
+  curl_easy_setopt(curl, CURLOPT_COPYPOSTFIELDS,
+                   args.postFields != NULL ? args.postFields : "");
+
+  mutation->request =
+      (struct pendingRequest){.handler = finishMutation,
+                              .data = mutation,
+                              .class = REQUEST_INTERACTIVE,
+                              .restart = restartMutation,
+                              .bucket = apiBucketFor(args.url)};
+  if (!startRequest(curl, &mutation->request)) {
+    freeMutation(mutation);
+    return NULL;
+  }
+  mutation->next = view->mutations;
+  view->mutations = mutation;
+  view->pendingMutations++;
+  return mutation;
+}
+
+struct pendingMutation *findPendingMutation(struct taskView *view,
+                                            const char *id) {
+  for (struct pendingMutation *mutation = view->mutations; mutation != NULL;
+       mutation = mutation->next) {
+    if (strcmp(mutation->id, id) == 0) {
+      return mutation;
+    }
+    // Only the first of a batch of new tasks goes by the mutation's id
+    for (int i = 1;
+         mutation->type == MUTATION_CREATE && i < mutation->tasksLength; i++) {
+      if (strcmp(getJsonValue(mutation->tasks[i], "id"), id) == 0) {
+        return mutation;
+      }
+    }
+  }
+  return NULL;
+}
+
+void reloadTaskRows(struct taskView *view) {
+  struct taskTree *tree = buildTaskTree(view->json);
+  if (tree == NULL) {
+    return;
+  }
+
+  // Whatever's still in flight stays off the list
+  for (struct pendingMutation *mutation = view->mutations; mutation != NULL;
+       mutation = mutation->next) {
+    int node = stringMapGet(&tree->ids, mutation->id);
+    if (node != -1 && (mutation->type == MUTATION_CLOSE ||
+                       mutation->type == MUTATION_DELETE)) {
+      removeTaskNode(tree, node, mutation->type == MUTATION_CLOSE);
+    }
+  }
+
+  // Keep the cursor on the same task, on the same row, if it's still there
+  struct listView *list = &view->list;
+  int cursor = -1;
+  if (list->cursor != -1) {
+    cursor = stringMapGet(
+        &tree->ids, cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(
+                        view->tree->nodes[list->cursor].json, "id")));
+  }
+  int top = cursor;
+  for (int row = list->cursorRow;
+       row > 0 && top != -1 && tree->nodes[top].prevVisible != -1; row--) {
+    top = tree->nodes[top].prevVisible;
+  }
+
+  freeTaskTree(view->tree);
+  view->tree = tree;
+  list->cursor = cursor;
+  list->top = top;
+  forgetTaskRow(list, -1);
+  settleTaskCursor(view);
+  drawTaskRows(view, 0, list->height);
+}
+
+static void hideTaskNotice(void *data) {
+  struct taskView *view = (struct taskView *)data;
+  view->noticeTimer = -1;
+
+  // Whoever's waiting for a key might have put a prompt there since
+  if (eventLoop.modal > 0) {
+    return;
+  }
+  werase(view->status);
+  if (view->asking != NULL || view->searching != NULL) {
+    drawTaskPrompt(view);
+  } else {
+    drawFrameStats(view->status);
+  }
+  wnoutrefresh(view->status);
+  presentFrame();
+}
+
+void showTaskNotice(struct taskView *view, const char *message) {
+  if (view->noticeTimer != -1) {
+    cancelTimer(view->noticeTimer);
+  }
+  werase(view->status);
+  // Stopping short of the last column keeps the cursor from wrapping
+  waddnstr(view->status, message, getmaxx(view->status) - 1);
+  drawFrameStats(view->status);
+  wnoutrefresh(view->list.window);
+  wnoutrefresh(view->status);
+  presentFrame();
+  view->noticeTimer = addTimer(NOTICE_MS, hideTaskNotice, view);
+}
+
+// FNV-1a. Nothing fancy, it just needs to be fast and spread ids out well.
+static unsigned long hashString(const char *str) {
+  unsigned long hash = 14695981039346656037UL;
+  while (*str) {
+    hash ^= (unsigned char)*str++;
+    hash *= 1099511628211UL;
+  }
+  return hash;
+}
+
+int stringMapInit(struct stringMap *map, int capacity) {
+  // Keep capacity a power of two so we can mask instead of mod
+  int realCapacity = 16;
+  while (realCapacity < capacity * 2) {
+    realCapacity *= 2;
+  }
+
+  map->keys = calloc(realCapacity, sizeof(char *));
+  map->values = malloc(realCapacity * sizeof(int));
+  if (map->keys == NULL || map->values == NULL) {
+    free(map->keys);
+    free(map->values);
+    return 0;
+  }
+  map->capacity = realCapacity;
+  map->length = 0;
+  return 1;
+}
+
+int stringMapGet(struct stringMap *map, const char *key) {
+  if (key == NULL || map->capacity == 0) {
+    return -1;
+  }
+  int mask = map->capacity - 1;
+  int i = hashString(key) & mask;
+  while (map->keys[i] != NULL) {
+    if (strcmp(map->keys[i], key) == 0) {
+      return map->values[i];
+    }
+    i = (i + 1) & mask;
+  }
+  return -1;
+}
+
+int stringMapPut(struct stringMap *map, const char *key, int value) {
+  if (key == NULL) {
+    return 0;
+  }
+
+  // Grow at 50% load so probe chains stay short
+  if ((map->length + 1) * 2 > map->capacity) {
+    struct stringMap bigger;
+    if (!stringMapInit(&bigger, map->capacity)) {
+      return 0;
+    }
+    for (int i = 0; i < map->capacity; i++) {
+      if (map->keys[i] != NULL) {
+        stringMapPut(&bigger, map->keys[i], map->values[i]);
+      }
+    }
+    stringMapFree(map);
+    *map = bigger;
+  }
+
+  int mask = map->capacity - 1;
+  int i = hashString(key) & mask;
+  while (map->keys[i] != NULL) {
+    if (strcmp(map->keys[i], key) == 0) {
+      map->values[i] = value;
+      return 1;
+    }
+    i = (i + 1) & mask;
+  }
+  map->keys[i] = key;
+  map->values[i] = value;
+  map->length++;
+  return 1;
+}
+
+void stringMapRemove(struct stringMap *map, const char *key) {
+  if (key == NULL || map->capacity == 0) {
+    return;
+  }
+  int mask = map->capacity - 1;
+  int i = hashString(key) & mask;
+  while (map->keys[i] != NULL && strcmp(map->keys[i], key) != 0) {
+    i = (i + 1) & mask;
+  }
+  if (map->keys[i] == NULL) {
+    return;
+  }
+
+  // Shift later entries of the probe chain back, so lookups never stop early
+  // at the hole (no tombstones needed)
+  int hole = i;
+  for (int j = (hole + 1) & mask; map->keys[j] != NULL; j = (j + 1) & mask) {
+    int home = hashString(map->keys[j]) & mask;
+    if (((j - home) & mask) >= ((j - hole) & mask)) {
+      map->keys[hole] = map->keys[j];
+      map->values[hole] = map->values[j];
+      hole = j;
+    }
+  }
+  map->keys[hole] = NULL;
+  map->length--;
+}
+
+void stringMapFree(struct stringMap *map) {
+  free(map->keys);
+  free(map->values);
+  map->keys = NULL;
+  map->values = NULL;
+  map->capacity = 0;
+  map->length = 0;
+}
+
+// Appends child to the end of parent's list of children
+static void appendTaskChild(struct taskNode *nodes, int parent, int child) {
+  nodes[child].parent = parent;
+  nodes[child].prevSibling = nodes[parent].lastChild;
+  nodes[child].nextSibling = -1;
+  if (nodes[parent].lastChild == -1) {
+    nodes[parent].firstChild = child;
+  } else {
+    nodes[nodes[parent].lastChild].nextSibling = child;
+  }
+  nodes[parent].lastChild = child;
+}
+
+// The next node in pre-order that isn't under cur, stopping at the end of
+// root's subtree. A root of -1 means the whole tree.
+static int nextTaskAfterSubtree(struct taskNode *nodes, int root, int cur) {
+  while (cur != root && nodes[cur].nextSibling == -1) {
+    cur = nodes[cur].parent;
+  }
+  return cur == root ? -1 : nodes[cur].nextSibling;
+}
+
+// Going down while we can, and climbing back up through the parents when we
+// run out of siblings, needs neither recursion nor a stack
+int nextTaskInSubtree(struct taskNode *nodes, int root, int cur) {
+  if (nodes[cur].firstChild != -1) {
+    return nodes[cur].firstChild;
+  }
+  return nextTaskAfterSubtree(nodes, root, cur);
+}
+
+// Puts node in the visible list right after previous (-1 for the front)
+static void linkVisibleTask(struct taskTree *tree, int previous, int node) {
+  struct taskNode *nodes = tree->nodes;
+  int next = previous == -1 ? tree->firstVisible : nodes[previous].nextVisible;
+  nodes[node].prevVisible = previous;
+  nodes[node].nextVisible = next;
+  if (previous == -1) {
+    tree->firstVisible = node;
+  } else {
+    nodes[previous].nextVisible = node;
+  }
+  if (next == -1) {
+    tree->lastVisible = node;
+  } else {
+    nodes[next].prevVisible = node;
+  }
+  nodes[node].visible = 1;
+  tree->visibleLength++;
+}
+
+static void unlinkVisibleTask(struct taskTree *tree, int node) {
+  struct taskNode *nodes = tree->nodes;
+  int previous = nodes[node].prevVisible;
+  int next = nodes[node].nextVisible;
+  if (previous == -1) {
+    tree->firstVisible = next;
+  } else {
+    nodes[previous].nextVisible = next;
+  }
+  if (next == -1) {
+    tree->lastVisible = previous;
+  } else {
+    nodes[next].prevVisible = previous;
+  }
+  nodes[node].visible = 0;
+  tree->visibleLength--;
+}
+
+struct taskTree *buildTaskTree(cJSON *tasksJson) {
+  int tasksLength = cJSON_GetArraySize(tasksJson);
+  int capacity = tasksLength + 1;
+
+  struct taskTree *tree = calloc(1, sizeof(struct taskTree));
+  if (tree == NULL) {
+    return NULL;
+  }
+  tree->nodes = malloc(capacity * sizeof(struct taskNode));
+
+  // Roots are bucketed by section before being chained together. Bucket 0 is
+  // for tasks without a section, which Todoist shows first.
+  struct stringMap sections = {0};
+  int *sectionFirst = malloc(capacity * sizeof(int));
+  int *sectionLast = malloc(capacity * sizeof(int));
+  int sectionsLength = 1;
+  char **parentIds = malloc(capacity * sizeof(char *));
+  char **sectionIds = malloc(capacity * sizeof(char *));
+
+  if (tree->nodes == NULL || sectionFirst == NULL || sectionLast == NULL ||
+      parentIds == NULL || sectionIds == NULL ||
+      !stringMapInit(&tree->ids, tasksLength) ||
+      !stringMapInit(&sections, 16)) {
+    free(sectionFirst);
+    free(sectionLast);
+    free(parentIds);
+    free(sectionIds);
+    stringMapFree(&sections);
+    freeTaskTree(tree);
+    return NULL;
+  }
+  sectionFirst[0] = -1;
+  sectionLast[0] = -1;
+
+  // First pass: one node per task, and an id -> node lookup
+  struct taskNode *nodes = tree->nodes;
+  cJSON *task = NULL;
+  int i = 0;
+  cJSON_ArrayForEach(task, tasksJson) {
+    nodes[i] = (struct taskNode){.json = task,
+                                 .parent = -1,
+                                 .firstChild = -1,
+                                 .lastChild = -1,
+                                 .prevSibling = -1,
+                                 .nextSibling = -1,
+                                 .prevVisible = -1,
+                                 .nextVisible = -1,
+                                 .section = -1};
+
+    // One walk over the task's fields, rather than a lookup for each of them
+    char *id = NULL;
+    parentIds[i] = NULL;
+    sectionIds[i] = NULL;
+    cJSON *field = NULL;
+    cJSON_ArrayForEach(field, task) {
+      if (strcmp(field->string, "id") == 0) {
+        id = cJSON_GetStringValue(field);
+      } else if (strcmp(field->string, "parent_id") == 0) {
+        parentIds[i] = cJSON_GetStringValue(field);
+      } else if (strcmp(field->string, "section_id") == 0) {
+        sectionIds[i] = cJSON_GetStringValue(field);
+      }
+    }
+    stringMapPut(&tree->ids, id, i);
+    i++;
+  }
+  tree->length = tasksLength;
+
+  // Second pass: hook every node up to its parent (or its section's roots)
+  for (i = 0; i < tasksLength; i++) {
+    int parent = stringMapGet(&tree->ids, parentIds[i]);
+    if (parent != -1 && parent != i) {
+      appendTaskChild(nodes, parent, i);
+      continue;
+    }
+
+    char *sectionId = sectionIds[i];
+    int section = 0;
+    if (sectionId != NULL) {
+      section = stringMapGet(&sections, sectionId);
+      if (section == -1) {
+        section = sectionsLength++;
+        sectionFirst[section] = -1;
+        sectionLast[section] = -1;
+        stringMapPut(&sections, sectionId, section);
+      }
+    }
+
+    nodes[i].prevSibling = sectionLast[section];
+    if (sectionLast[section] == -1) {
+      sectionFirst[section] = i;
+    } else {
+      nodes[sectionLast[section]].nextSibling = i;
+    }
+    sectionLast[section] = i;
+  }
+  free(parentIds);
+
+  // Every section might need a header node
+  tree->capacity = tasksLength + sectionsLength;
+  nodes = realloc(tree->nodes, tree->capacity * sizeof(struct taskNode));
+  if (nodes == NULL) {
+    free(sectionFirst);
+    free(sectionLast);
+    free(sectionIds);
+    stringMapFree(&sections);
+    freeTaskTree(tree);
+    return NULL;
+  }
+  tree->nodes = nodes;
+
+  // Chain the sections together into one list of roots. Named sections start
+  // with a header, which is a root without any json.
+  tree->firstRoot = -1;
+  tree->lastRoot = -1;
+  tree->firstHeader = -1;
+  for (int section = 0; section < sectionsLength; section++) {
+    if (sectionFirst[section] == -1) {
+      continue;
+    }
+
+    int first = sectionFirst[section];
+    int interned =
+        section == 0 ? -1 : lookupInterned(&sectionTable, sectionIds[first]);
+    if (interned != -1 && sectionTable.names[interned] != NULL) {
+      int header = tree->length++;
+      nodes[header] = (struct taskNode){.parent = -1,
+                                        .firstChild = -1,
+                                        .lastChild = -1,
+                                        .prevSibling = -1,
+                                        .nextSibling = first,
+                                        .prevVisible = -1,
+                                        .nextVisible = -1,
+                                        .section = interned};
+      nodes[first].prevSibling = header;
+      first = header;
+      if (tree->firstHeader == -1) {
+        tree->firstHeader = header;
+      }
+    }
+
+    if (tree->lastRoot == -1) {
+      tree->firstRoot = first;
+    } else {
+      nodes[tree->lastRoot].nextSibling = first;
+      nodes[first].prevSibling = tree->lastRoot;
+    }
+    tree->lastRoot = sectionLast[section];
+  }
+  free(sectionFirst);
+  free(sectionLast);
+  free(sectionIds);
+  stringMapFree(&sections);
+
+  // Everything starts expanded, so the visible list is the whole pre-order
+  tree->firstVisible = -1;
+  tree->lastVisible = -1;
+  for (int cur = tree->firstRoot; cur != -1;
+       cur = nextTaskInSubtree(nodes, -1, cur)) {
+    int parent = nodes[cur].parent;
+    nodes[cur].depth = parent == -1 ? 0 : nodes[parent].depth + 1;
+    linkVisibleTask(tree, tree->lastVisible, cur);
+  }
+
+  // Anything caught in a parent_id cycle never gets reached, and just isn't
+  // shown
+  return tree;
+}
+
+void freeTaskTree(struct taskTree *tree) {
+  if (tree == NULL) {
+    return;
+  }
+  free(tree->nodes);
+  stringMapFree(&tree->ids);
+  free(tree);
+}
+
+void toggleTaskCollapsed(struct taskTree *tree, int node) {
+  struct taskNode *nodes = tree->nodes;
+
+  // Hidden nodes just remember the flag for when they're shown again, and so
+  // does everything while a search decides what's shown
+  if (!nodes[node].visible || tree->filtered) {
+    nodes[node].collapsed = !nodes[node].collapsed;
+    return;
+  }
+
+  if (!nodes[node].collapsed) {
+    // Everything after node that's deeper than it is part of its subtree
+    int next = nodes[node].nextVisible;
+    while (next != -1 && nodes[next].depth > nodes[node].depth) {
+      nodes[next].visible = 0;
+      next = nodes[next].nextVisible;
+      tree->visibleLength--;
+    }
+    nodes[node].nextVisible = next;
+    if (next == -1) {
+      tree->lastVisible = node;
+    } else {
+      nodes[next].prevVisible = node;
+    }
+    nodes[node].collapsed = 1;
+    return;
+  }
+
+  // Expanding: splice the subtree back in, skipping anything under a
+  // collapsed descendant
+  nodes[node].collapsed = 0;
+  int previous = node;
+  int cur = nodes[node].firstChild;
+  while (cur != -1) {
+    linkVisibleTask(tree, previous, cur);
+    previous = cur;
+    cur = nodes[cur].collapsed ? nextTaskAfterSubtree(nodes, node, cur)
+                               : nextTaskInSubtree(nodes, node, cur);
+  }
+}
+
+void removeTaskNode(struct taskTree *tree, int node, int keepChildren) {
+  struct taskNode *nodes = tree->nodes;
+
+  // Children that stay have to be on screen where node was
+  if (keepChildren && nodes[node].collapsed) {
+    toggleTaskCollapsed(tree, node);
+  }
+
+  // Children that stay move up a level, otherwise their rows and ids go too
+  for (int cur = node; cur != -1; cur = nextTaskInSubtree(nodes, node, cur)) {
+    if (cur != node && keepChildren) {
+      nodes[cur].depth--;
+      continue;
+    }
+    if (nodes[cur].visible) {
+      unlinkVisibleTask(tree, cur);
+    }
+    stringMapRemove(&tree->ids,
+                    cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(
+                        nodes[cur].json, "id")));
+  }
+
+  // Take node's place among its siblings, either with its children or with
+  // nothing
+  int parent = nodes[node].parent;
+  int previous = nodes[node].prevSibling;
+  int next = nodes[node].nextSibling;
+  if (keepChildren && nodes[node].firstChild != -1) {
+    for (int child = nodes[node].firstChild; child != -1;
+         child = nodes[child].nextSibling) {
+      nodes[child].parent = parent;
+    }
+    nodes[nodes[node].firstChild].prevSibling = previous;
+    nodes[nodes[node].lastChild].nextSibling = next;
+    int first = nodes[node].firstChild;
+    int last = nodes[node].lastChild;
+    nodes[node].firstChild = -1;
+    nodes[node].lastChild = -1;
+    if (previous == -1) {
+      *(parent == -1 ? &tree->firstRoot : &nodes[parent].firstChild) = first;
+    } else {
+      nodes[previous].nextSibling = first;
+    }
+    if (next == -1) {
+      *(parent == -1 ? &tree->lastRoot : &nodes[parent].lastChild) = last;
+    } else {
+      nodes[next].prevSibling = last;
+    }
+    return;
+  }
+
+  if (previous == -1) {
+    *(parent == -1 ? &tree->firstRoot : &nodes[parent].firstChild) = next;
+  } else {
+    nodes[previous].nextSibling = next;
+  }
+  if (next == -1) {
+    *(parent == -1 ? &tree->lastRoot : &nodes[parent].lastChild) = previous;
+  } else {
+    nodes[next].prevSibling = previous;
+  }
+}
+
+int insertTaskNode(struct taskTree *tree, cJSON *task) {
+  if (tree->length == tree->capacity) {
+    int capacity = tree->capacity * 2;
+    struct taskNode *nodes =
+        realloc(tree->nodes, capacity * sizeof(struct taskNode));
+    if (nodes == NULL) {
+      return -1;
+    }
+    tree->nodes = nodes;
+    tree->capacity = capacity;
+  }
+
+  struct taskNode *nodes = tree->nodes;
+  int node = tree->length;
+  char *id = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(task, "id"));
+  if (!stringMapPut(&tree->ids, id, node)) {
+    return -1;
+  }
+  tree->length++;
+  nodes[node] = (struct taskNode){.json = task,
+                                 .parent = -1,
+                                 .firstChild = -1,
+                                 .lastChild = -1,
+                                 .prevSibling = -1,
+                                 .nextSibling = -1,
+                                 .prevVisible = -1,
+                                 .nextVisible = -1,
+                                 .section = -1};
+
+  // New tasks don't have a section, so they go after the other tasks without
+  // one, which is right before the first header
+  int next = tree->firstHeader;
+  int previous = next == -1 ? tree->lastRoot : nodes[next].prevSibling;
+  nodes[node].prevSibling = previous;
+  nodes[node].nextSibling = next;
+  if (previous == -1) {
+    tree->firstRoot = node;
+  } else {
+    nodes[previous].nextSibling = node;
+  }
+  if (next == -1) {
+    tree->lastRoot = node;
+  } else {
+    nodes[next].prevSibling = node;
+  }
+
+  // Same for its row. Search results have no headers, so there it goes last.
+  linkVisibleTask(tree,
+                  next == -1 || tree->filtered ? tree->lastVisible
+                                               : nodes[next].prevVisible,
+                  node);
+  return node;
+}
+
+void resetVisibleTasks(struct taskTree *tree) {
+  struct taskNode *nodes = tree->nodes;
+  for (int i = 0; i < tree->length; i++) {
+    nodes[i].visible = 0;
+  }
+  tree->firstVisible = -1;
+  tree->lastVisible = -1;
+  tree->visibleLength = 0;
+  tree->filtered = 0;
+
+  int cur = tree->firstRoot;
+  while (cur != -1) {
+    linkVisibleTask(tree, tree->lastVisible, cur);
+    cur = nodes[cur].collapsed ? nextTaskAfterSubtree(nodes, -1, cur)
+                               : nextTaskInSubtree(nodes, -1, cur);
+  }
+}
+
+void showOnlyTasks(struct taskTree *tree, int *matches, int length) {
+  struct taskNode *nodes = tree->nodes;
+  for (int i = 0; i < tree->length; i++) {
+    nodes[i].visible = 0;
+  }
+  for (int i = 0; i < length; i++) {
+    nodes[matches[i]].visible = 1;
+  }
+  tree->firstVisible = -1;
+  tree->lastVisible = -1;
+  tree->visibleLength = 0;
+  tree->filtered = 1;
+
+  // Matches are shown in tree order, whatever order they came in
+  for (int cur = tree->firstRoot; cur != -1;
+       cur = nextTaskInSubtree(nodes, -1, cur)) {
+    if (nodes[cur].visible) {
+      linkVisibleTask(tree, tree->lastVisible, cur);
+    }
+  }
+}
+
+// Draws node on a row of the list window, or blanks the row if node is -1
+static void drawTaskRow(struct taskView *view, int row, int node) {
+  struct listView *list = &view->list;
+  WINDOW *window = list->window;
+  wmove(window, row, 0);
+  wclrtoeol(window);
+  if (node == -1) {
+    return;
+  }
+
+  // Measuring and cutting happens once per row here, so drawing a screen of
+  // cached rows is just copying them out
+  struct taskNode *taskNode = &view->tree->nodes[node];
+  struct listRow *listRow = &list->rows[node % list->rowsLength];
+  if (listRow->node != node && taskNode->json == NULL) {
+    fitTextToWidth(listRow->text, list->rowBytes,
+                   sectionTable.names[taskNode->section], list->width);
+    listRow->node = node;
+  } else if (listRow->node != node) {
+    // The name is indented by depth, and collapsed tasks with subtasks get a
+    // '+' so they don't look empty. The priority stays on screen however long
+    // the name is.
+    char *content = getJsonValue(taskNode->json, "content");
+    char marker =
+        taskNode->collapsed && taskNode->firstChild != -1 ? '+' : ' ';
+    char prefix[64];
+    char suffix[16];
+    int prefixLength = snprintf(prefix, sizeof(prefix), "%*s%c ",
+                                taskNode->depth * 2, "", marker);
+    int suffixLength = snprintf(suffix, sizeof(suffix), " %d",
+                                getJsonIntValue(taskNode->json, "priority"));
+    int columns = list->width - prefixLength - suffixLength;
+    if (prefixLength >= (int)sizeof(prefix) || columns < 1) {
+      // Too narrow (or too deep) for that, so just cut the whole line
+      char *line = malloc(strlen(content == NULL ? "" : content) + 96);
+      if (line != NULL) {
+        sprintf(line, "%*s%c %s %d", taskNode->depth * 2, "", marker,
+                content == NULL ? "" : content,
+                getJsonIntValue(taskNode->json, "priority"));
+        fitTextToWidth(listRow->text, list->rowBytes, line, list->width);
+        free(line);
+      } else {
+        listRow->text[0] = '\0';
+      }
+    } else {
+      memcpy(listRow->text, prefix, prefixLength);
+      char *end = listRow->text + prefixLength;
+      fitTextToWidth(end, list->rowBytes - prefixLength - suffixLength,
+                     content == NULL ? "" : content, columns);
+      strcat(end, suffix);
+    }
+    listRow->node = node;
+  }
+
+  if (taskNode->json == NULL) {
+    wattron(window, A_BOLD);
+  } else if (node == list->cursor) {
+    wattron(window, A_REVERSE);
+  }
+  waddstr(window, listRow->text);
+  wattroff(window, A_BOLD | A_REVERSE);
+}
+
+int allocTaskRows(struct listView *list) {
+  list->rowsLength = list->height + 2 * LIST_ROW_MARGIN;
+  // Room for a few bytes per column, since UTF-8 takes up to four for one and
+  // combining marks add more without taking any
+  list->rowBytes = list->width * 4 + 16;
+  list->rows = malloc(list->rowsLength * sizeof(struct listRow));
+  char *texts = malloc(list->rowsLength * list->rowBytes);
+  if (list->rows == NULL || texts == NULL) {
+    free(list->rows);
+    free(texts);
+    list->rows = NULL;
+    return 0;
+  }
+  for (int i = 0; i < list->rowsLength; i++) {
+    list->rows[i] =
+        (struct listRow){.node = -1, .text = texts + i * list->rowBytes};
+  }
+  return 1;
+}
+
+void freeTaskRows(struct listView *list) {
+  if (list->rows == NULL) {
+    return;
+  }
+  free(list->rows[0].text);
+  free(list->rows);
+  list->rows = NULL;
+}
+
+int fitTextToWidth(char *buffer, int size, const char *text, int columns) {
+  // The ellipsis is whatever the locale makes of it, or a '~' if it can't
+  char ellipsis[MB_LEN_MAX + 1];
+  mbstate_t state;
+  memset(&state, 0, sizeof(state));
+  size_t ellipsisLength = wcrtomb(ellipsis, L'\u2026', &state);
+  int ellipsisWidth = 1;
+  if (ellipsisLength == (size_t)-1 ||
+      (ellipsisWidth = wcwidth(L'\u2026')) < 1) {
+    strcpy(ellipsis, "~");
+    ellipsisLength = 1;
+    ellipsisWidth = 1;
+  }
+  ellipsis[ellipsisLength] = '\0';
+
+  // Copy while it fits, remembering the last spot the ellipsis would still
+  // fit after in case it turns out not to. Zero width characters move that
+  // spot along with them, so they're never split from what they modify.
+  int used = 0;
+  int length = 0;
+  int cutUsed = 0;
+  int cutLength = 0;
+  const char *cur = text;
+  memset(&state, 0, sizeof(state));
+  while (*cur != '\0') {
+    // Anything that isn't valid or printable takes a column as a '?'
+    wchar_t wide;
+    size_t bytes = mbrtowc(&wide, cur, MB_CUR_MAX, &state);
+    int width = 1;
+    int printable = 0;
+    if (bytes == (size_t)-1 || bytes == (size_t)-2 || bytes == 0) {
+      memset(&state, 0, sizeof(state));
+      bytes = 1;
+    } else if ((width = wcwidth(wide)) >= 0) {
+      printable = 1;
+    } else {
+      width = 1;
+    }
+    int outLength = printable ? (int)bytes : 1;
+
+    if (used + width > columns || length + outLength >= size) {
+      if (cutUsed + ellipsisWidth > columns) {
+        buffer[cutLength] = '\0';
+        return cutUsed;
+      }
+      memcpy(buffer + cutLength, ellipsis, ellipsisLength + 1);
+      return cutUsed + ellipsisWidth;
+    }
+    if (printable) {
+      memcpy(buffer + length, cur, bytes);
+    } else {
+      buffer[length] = '?';
+    }
+    length += outLength;
+    used += width;
+    cur += bytes;
+    if (used + ellipsisWidth <= columns &&
+        length + (int)ellipsisLength < size) {
+      cutUsed = used;
+      cutLength = length;
+    }
+  }
+  buffer[length] = '\0';
+  return used;
+}
+
+void forgetTaskRow(struct listView *list, int node) {
+  if (node == -1) {
+    for (int i = 0; i < list->rowsLength; i++) {
+      list->rows[i].node = -1;
+    }
+  } else if (list->rows[node % list->rowsLength].node == node) {
+    list->rows[node % list->rowsLength].node = -1;
+  }
+}
+
+void drawTaskRows(struct taskView *view, int from, int to) {
+  struct listView *list = &view->list;
+  struct taskNode *nodes = view->tree->nodes;
+  int node = list->top;
+  for (int row = 0; row < from && node != -1; row++) {
+    node = nodes[node].nextVisible;
+  }
+  for (int row = from; row < to && row < list->height; row++) {
+    drawTaskRow(view, row, node);
+    if (node != -1) {
+      node = nodes[node].nextVisible;
+    }
+  }
+
+  // QOL
+  if (list->top == -1 && from == 0) {
+    mvwaddnstr(list->window, 0, 0,
+               view->tree->filtered ? NO_MATCHING_TASKS_MESSAGE
+                                    : NO_TASKS_TO_COMPLETE_MESSAGE,
+               list->width);
+  }
+}
+
+void settleTaskCursor(struct taskView *view) {
+  struct listView *list = &view->list;
+  struct taskTree *tree = view->tree;
+  struct taskNode *nodes = tree->nodes;
+
+  if (list->top == -1 || !nodes[list->top].visible) {
+    list->top = tree->firstVisible;
+  }
+
+  // Section headers can't be selected, so look for a task after the cursor,
+  // and then before it
+  int cursor = list->cursor;
+  if (cursor == -1 || !nodes[cursor].visible) {
+    cursor = list->top;
+  }
+  int next = cursor;
+  while (next != -1 && nodes[next].json == NULL) {
+    next = nodes[next].nextVisible;
+  }
+  if (next == -1) {
+    next = cursor == -1 ? tree->lastVisible : cursor;
+    while (next != -1 && nodes[next].json == NULL) {
+      next = nodes[next].prevVisible;
+    }
+  }
+  list->cursor = next;
+  if (next == -1) {
+    list->cursorRow = 0;
+    return;
+  }
+
+  // Find the cursor's row. If it's off screen, scroll so it's the top one.
+  int row = 0;
+  int node = list->top;
+  while (node != -1 && node != list->cursor && row < list->height) {
+    node = nodes[node].nextVisible;
+    row++;
+  }
+  if (node != list->cursor || row == list->height) {
+    list->top = list->cursor;
+    node = list->cursor;
+    row = 0;
+  }
+  list->cursorRow = row;
+
+  // Don't leave blank rows at the bottom if there's more above
+  int rows = row;
+  for (; node != -1 && rows < list->height; rows++) {
+    node = nodes[node].nextVisible;
+  }
+  while (rows < list->height && nodes[list->top].prevVisible != -1) {
+    list->top = nodes[list->top].prevVisible;
+    list->cursorRow++;
+    rows++;
+  }
+}
+
+void moveTaskCursor(struct taskView *view, int distance) {
+  struct listView *list = &view->list;
+  struct taskNode *nodes = view->tree->nodes;
+  if (list->cursor == -1 || distance == 0) {
+    return;
+  }
+
+  // Skip over section headers, and stop at the last task there is
+  int target = list->cursor;
+  int steps = 0;
+  for (int moved = 0; moved < abs(distance); moved++) {
+    int next = target;
+    int nextSteps = steps;
+    do {
+      next = distance > 0 ? nodes[next].nextVisible : nodes[next].prevVisible;
+      nextSteps++;
+    } while (next != -1 && nodes[next].json == NULL);
+    if (next == -1) {
+      break;
+    }
+    target = next;
+    steps = nextSteps;
+  }
+  if (target == list->cursor) {
+    return;
+  }
+
+  int oldCursor = list->cursor;
+  int oldRow = list->cursorRow;
+  list->cursor = target;
+  list->cursorRow += distance > 0 ? steps : -steps;
+
+  int scroll = 0;
+  if (list->cursorRow < 0) {
+    scroll = list->cursorRow;
+  } else if (list->cursorRow >= list->height) {
+    scroll = list->cursorRow - list->height + 1;
+  }
+  if (scroll == 0) {
+    drawTaskRow(view, oldRow, oldCursor);
+    drawTaskRow(view, list->cursorRow, target);
+    return;
+  }
+
+  // Scrolling shifts what's already on screen, so only the rows coming in
+  // (and the old cursor) need drawing
+  for (int i = 0; i < abs(scroll); i++) {
+    list->top = scroll > 0 ? nodes[list->top].nextVisible
+                           : nodes[list->top].prevVisible;
+  }
+  list->cursorRow -= scroll;
+  oldRow -= scroll;
+  if (abs(scroll) >= list->height) {
+    drawTaskRows(view, 0, list->height);
+    return;
+  }
+  scrollok(list->window, TRUE);
+  wscrl(list->window, scroll);
+  scrollok(list->window, FALSE);
+  if (oldRow >= 0 && oldRow < list->height) {
+    drawTaskRow(view, oldRow, oldCursor);
+  }
+  if (scroll > 0) {
+    drawTaskRows(view, list->height - scroll, list->height);
+  } else {
+    drawTaskRows(view, 0, -scroll);
+  }
+}
+
+void pageTaskCursor(struct taskView *view, int direction) {
+  struct listView *list = &view->list;
+  struct taskNode *nodes = view->tree->nodes;
+  if (list->cursor == -1) {
+    return;
+  }
+
+  // Both move a screen's worth, so the cursor stays on the same row unless
+  // it runs into either end
+  for (int i = 0; i < list->height; i++) {
+    int cursor = direction > 0 ? nodes[list->cursor].nextVisible
+                               : nodes[list->cursor].prevVisible;
+    int top = direction > 0 ? nodes[list->top].nextVisible
+                            : nodes[list->top].prevVisible;
+    if (cursor != -1) {
+      list->cursor = cursor;
+    }
+    if (top != -1) {
+      list->top = top;
+    }
+  }
+  settleTaskCursor(view);
+  drawTaskRows(view, 0, list->height);
+}
+
+void jumpTaskCursor(struct taskView *view, int node) {
+  struct listView *list = &view->list;
+  if (node == -1) {
+    return;
+  }
+  list->top = node;
+  list->cursor = node;
+  settleTaskCursor(view);
+  drawTaskRows(view, 0, list->height);
+}
+
+void removeTaskRow(struct taskView *view, int keepChildren) {
+  struct listView *list = &view->list;
+  struct taskTree *tree = view->tree;
+  int node = list->cursor;
+  int previous = tree->nodes[node].prevVisible;
+  int oldTop = list->top;
+  int oldRow = list->cursorRow;
+
+  removeTaskNode(tree, node, keepChildren);
+  if (keepChildren) {
+    // Its subtasks are a level shallower now
+    forgetTaskRow(list, -1);
+  }
+
+  // Whatever was after node (or its first child) takes its place
+  int next = previous == -1 ? tree->firstVisible
+                            : tree->nodes[previous].nextVisible;
+  if (list->top == node) {
+    list->top = next != -1 ? next : previous;
+    oldTop = list->top;
+  }
+  list->cursor = next != -1 ? next : previous;
+  settleTaskCursor(view);
+
+  // Rows above the old cursor don't move, unless the list had to scroll
+  int from = list->top == oldTop
+                 ? (oldRow < list->cursorRow ? oldRow : list->cursorRow)
+                 : 0;
+  drawTaskRows(view, from, list->height);
+}
+
+int insertTaskRow(struct taskView *view, cJSON *task) {
+  struct listView *list = &view->list;
+  struct taskNode *nodes;
+  int node = insertTaskNode(view->tree, task);
+  if (node == -1) {
+    return 0;
+  }
+  nodes = view->tree->nodes;
+
+  if (list->cursor == -1) {
+    list->top = -1;
+    settleTaskCursor(view);
+    drawTaskRows(view, 0, list->height);
+    return 1;
+  }
+
+  // Rows above the new one don't change, and the ones below shift down. If it
+  // isn't on screen there's nothing to draw.
+  int row = 0;
+  int cur = list->top;
+  while (cur != -1 && cur != node && row < list->height) {
+    cur = nodes[cur].nextVisible;
+    row++;
+  }
+  if (cur != node || row == list->height) {
+    return 1;
+  }
+  if (row <= list->cursorRow && ++list->cursorRow == list->height) {
+    list->top = nodes[list->top].nextVisible;
+    list->cursorRow--;
+    drawTaskRows(view, 0, list->height);
+    return 1;
+  }
+  wmove(list->window, row, 0);
+  winsdelln(list->window, 1);
+  drawTaskRow(view, row, node);
+  return 1;
+}
+
+void formatLocalDate(char *buffer, int dayOffset) {
+  time_t now = time(NULL);
+  struct tm date;
+  localtime_r(&now, &date);
+
+  // mktime normalises things like the 32nd of a month for us
+  date.tm_mday += dayOffset;
+  date.tm_isdst = -1;
+  mktime(&date);
+  strftime(buffer, 11, "%Y-%m-%d", &date);
+}
+
+// Adds an instruction to the end of program. Returns 0 on failure.
+static int emitFilterInstruction(struct filterProgram *program,
+                                 enum filterOp op, int priority,
+                                 char *string) {
+  if (program->length == program->capacity) {
+    int newCapacity = program->capacity == 0 ? 8 : program->capacity * 2;
+    struct filterInstruction *newCode =
+        realloc(program->code, newCapacity * sizeof(struct filterInstruction));
+    if (newCode == NULL) {
+      free(string);
+      return 0;
+    }
+    program->code = newCode;
+    program->capacity = newCapacity;
+  }
+  program->code[program->length++] = (struct filterInstruction){
+      .op = op, .number = priority, .string = string};
+  return 1;
+}
+
+struct filterParser {
+  const char *cur;
+  struct filterProgram *program;
+  // Current and maximum size of the stack the program will need
+  int depth;
+  int failed;
+};
+
+static void skipFilterSpaces(struct filterParser *parser) {
+  while (*parser->cur == ' ') {
+    parser->cur++;
+  }
+}
+
+// Every atom leaves one value on the stack when it's run
+static void pushFilterDepth(struct filterParser *parser) {
+  parser->depth++;
+  if (parser->depth > parser->program->stackDepth) {
+    parser->program->stackDepth = parser->depth;
+  }
+}
+
+// Atoms run up to the next operator, so project names can have spaces in them
+static void parseFilterAtom(struct filterParser *parser) {
+  const char *start = parser->cur;
+  while (*parser->cur != '\0' && strchr("&|)", *parser->cur) == NULL) {
+    parser->cur++;
+  }
+  int length = parser->cur - start;
+  while (length > 0 && start[length - 1] == ' ') {
+    length--;
+  }
+  if (length == 0) {
+    parser->failed = 1;
+    return;
+  }
+
+  char atom[length + 1];
+  memcpy(atom, start, length);
+  atom[length] = '\0';
+
+  int emitted = 0;
+  int days = 0;
+  int consumed = 0;
+  if (strcasecmp(atom, "today") == 0) {
+    emitted = emitFilterInstruction(parser->program, FILTER_TODAY, 0, NULL);
+  } else if (strcasecmp(atom, "overdue") == 0) {
+    emitted = emitFilterInstruction(parser->program, FILTER_OVERDUE, 0, NULL);
+    parser->program->usesMinute = 1;
+  } else if (sscanf(atom, "next %d days%n", &days, &consumed) == 1 &&
+             consumed == length && days > 0) {
+    emitted =
+        emitFilterInstruction(parser->program, FILTER_UPCOMING, days, NULL);
+  } else if ((atom[0] == 'p' || atom[0] == 'P') && length == 2 &&
+             atom[1] >= '1' && atom[1] <= '4') {
+    // Todoist priorities come in the form: P1 = 4, P4 = 1
+    emitted = emitFilterInstruction(parser->program, FILTER_PRIORITY,
+                                    5 - (atom[1] - '0'), NULL);
+  } else if (atom[0] == '#' && length > 1) {
+    // Looked up when it's run, so projects made or renamed since still match
+    char *name = strdup(atom + 1);
+    emitted = name != NULL && emitFilterInstruction(parser->program,
+                                                    FILTER_PROJECT, 0, name);
+  } else if (atom[0] == '@' && length > 1) {
+    // Interning a label nobody has yet is fine, it just never matches
+    int label = internLabel(atom + 1);
+    emitted = label != -1 && emitFilterInstruction(parser->program,
+                                                   FILTER_LABEL, label, NULL);
+  } else if (atom[0] == '/' && length > 1) {
+    // Section names aren't unique across projects, so match any of them,
+    // or'ed together as we go
+    for (int i = 0; i < sectionTable.length; i++) {
+      if (sectionTable.names[i] == NULL ||
+          strcasecmp(sectionTable.names[i], atom + 1) != 0) {
+        continue;
+      }
+      if (!emitFilterInstruction(parser->program, FILTER_SECTION, i, NULL)) {
+        parser->failed = 1;
+        return;
+      }
+      pushFilterDepth(parser);
+      if (emitted) {
+        if (!emitFilterInstruction(parser->program, FILTER_OR, 0, NULL)) {
+          parser->failed = 1;
+          return;
+        }
+        parser->depth--;
+      }
+      emitted = 1;
+    }
+    if (!emitted) {
+      parser->failed = 1;
+    }
+    return;
+  }
+
+  if (!emitted) {
+    parser->failed = 1;
+    return;
+  }
+  pushFilterDepth(parser);
+}
+
+static void parseFilterOr(struct filterParser *parser);
+
+static void parseFilterUnary(struct filterParser *parser) {
+  skipFilterSpaces(parser);
+  if (*parser->cur == '!') {
+    parser->cur++;
+    parseFilterUnary(parser);
+    if (!parser->failed &&
+        !emitFilterInstruction(parser->program, FILTER_NOT, 0, NULL)) {
+      parser->failed = 1;
+    }
+  } else if (*parser->cur == '(') {
+    parser->cur++;
+    parseFilterOr(parser);
+    skipFilterSpaces(parser);
+    if (*parser->cur != ')') {
+      parser->failed = 1;
+      return;
+    }
+    parser->cur++;
+  } else {
+    parseFilterAtom(parser);
+  }
+}
+
+// Shared by & and |, which only differ in precedence
+static void parseFilterBinary(struct filterParser *parser, char operator,
+                              enum filterOp op,
+                              void (*parseOperand)(struct filterParser *)) {
+  parseOperand(parser);
+  while (!parser->failed) {
+    skipFilterSpaces(parser);
+    if (*parser->cur != operator) {
+      return;
+    }
+    parser->cur++;
+    parseOperand(parser);
+    if (parser->failed ||
+        !emitFilterInstruction(parser->program, op, 0, NULL)) {
+      parser->failed = 1;
+      return;
+    }
+    parser->depth--;
+  }
+}
+
+static void parseFilterAnd(struct filterParser *parser) {
+  parseFilterBinary(parser, '&', FILTER_AND, parseFilterUnary);
+}
+
+static void parseFilterOr(struct filterParser *parser) {
+  parseFilterBinary(parser, '|', FILTER_OR, parseFilterAnd);
+}
+
+struct filterProgram *compileFilter(const char *query) {
+  struct filterProgram *program = calloc(1, sizeof(struct filterProgram));
+  if (program == NULL) {
+    return NULL;
+  }
+
+  struct filterParser parser = {.cur = query, .program = program};
+  parseFilterOr(&parser);
+  skipFilterSpaces(&parser);
+  if (parser.failed || *parser.cur != '\0') {
+    freeFilterProgram(program);
+    return NULL;
+  }
+  return program;
+}
+
+void freeFilterProgram(struct filterProgram *program) {
+  if (program == NULL) {
+    return;
+  }
+  for (int i = 0; i < program->length; i++) {
+    free(program->code[i].string);
+  }
+  free(program->code);
+  free(program);
+}
+
+int runFilterProgram(struct filterProgram *program, struct cachedTask *task,
+                     int today, int nowMinute, int *stack) {
+  int top = 0;
+  for (int i = 0; i < program->length; i++) {
+    struct filterInstruction *instruction = &program->code[i];
+    const char *value;
+
+    switch (instruction->op) {
+    case FILTER_TODAY:
+      stack[top++] = task->dueDay == today;
+      break;
+    case FILTER_OVERDUE:
+      // Timed tasks from earlier today count as overdue too
+      stack[top++] = task->dueDay != NO_DUE_DAY &&
+                     (task->dueDay < today ||
+                      (task->dueDay == today && task->dueMinute >= 0 &&
+                       task->dueMinute < nowMinute));
+      break;
+    case FILTER_UPCOMING:
+      stack[top++] = task->dueDay != NO_DUE_DAY && task->dueDay >= today &&
+                     task->dueDay < today + instruction->number;
+      break;
+    case FILTER_PRIORITY:
+      stack[top++] = cJSON_GetNumberValue(cJSON_GetObjectItemCaseSensitive(
+                         task->json, "priority")) == instruction->number;
+      break;
+    case FILTER_PROJECT:
+      value = cJSON_GetStringValue(
+          cJSON_GetObjectItemCaseSensitive(task->json, "project_id"));
+      stack[top++] = value != NULL && instruction->projectId != NULL &&
+                     strcmp(value, instruction->projectId) == 0;
+      break;
+    case FILTER_LABEL:
+      stack[top++] = (task->labels[instruction->number / 64] >>
+                      (instruction->number % 64)) &
+                     1;
+      break;
+    case FILTER_SECTION:
+      stack[top++] = task->section == instruction->number;
+      break;
+    case FILTER_AND:
+      top--;
+      stack[top - 1] = stack[top - 1] && stack[top];
+      break;
+    case FILTER_OR:
+      top--;
+      stack[top - 1] = stack[top - 1] || stack[top];
+      break;
+    case FILTER_NOT:
+      stack[top - 1] = !stack[top - 1];
+      break;
+    }
+  }
+  return top > 0 && stack[0];
+}
+
+// Points program's project names at the ids of the projects in projectsJson
+// with those names, skipping the filter views listed alongside them
+static void resolveFilterProjects(struct filterProgram *program,
+                                  cJSON *projectsJson) {
+  size_t prefixLength = strlen(FILTER_VIEW_ID_PREFIX);
+  for (int i = 0; i < program->length; i++) {
+    struct filterInstruction *instruction = &program->code[i];
+    if (instruction->op != FILTER_PROJECT) {
+      continue;
+    }
+    instruction->projectId = NULL;
+    cJSON *project = NULL;
+    cJSON_ArrayForEach(project, projectsJson) {
+      char *name = cJSON_GetStringValue(
+          cJSON_GetObjectItemCaseSensitive(project, "name"));
+      char *id =
+          cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(project, "id"));
+      if (name != NULL && id != NULL &&
+          strncmp(id, FILTER_VIEW_ID_PREFIX, prefixLength) != 0 &&
+          strcasecmp(name, instruction->string) == 0) {
+        instruction->projectId = id;
+        break;
+      }
+    }
+  }
+}
+
+cJSON *getFilterResults(struct filterView *view) {
+  int today, nowMinute;
+  getLocalDayMinute(&today, &nowMinute);
+  struct projectsView *projects = refresher.projects;
+  unsigned long projectsVersion = projects != NULL ? projects->version : 0;
+  if (view->results != NULL && view->version == taskCache.version &&
+      view->projectsVersion == projectsVersion && view->day == today &&
+      (!view->program->usesMinute || view->minute == nowMinute)) {
+    return view->results;
+  }
+
+  // The results only reference tasks in the cache, so this is cheap to throw
+  // away once the cache changes
+  cJSON_Delete(view->results);
+  view->results = cJSON_CreateArray();
+  view->version = taskCache.version;
+  view->projectsVersion = projectsVersion;
+  view->day = today;
+  view->minute = nowMinute;
+  view->generation++;
+  if (view->results == NULL) {
+    return NULL;
+  }
+
+  // Filters that are only a date range (like the built in Today) are answered
+  // straight from the due index
+  struct filterInstruction *only =
+      view->program->length == 1 ? &view->program->code[0] : NULL;
+  if (only != NULL && (only->op == FILTER_TODAY || only->op == FILTER_OVERDUE ||
+                       only->op == FILTER_UPCOMING)) {
+    struct dueIndex *index = &taskCache.due;
+    int start = 0;
+    int end = 0;
+    if (only->op == FILTER_TODAY) {
+      start = dueIndexLowerBound(index, today, INT_MIN);
+      end = dueIndexLowerBound(index, today + 1, INT_MIN);
+    } else if (only->op == FILTER_OVERDUE) {
+      // Everything before today, then whichever of today's timed tasks have
+      // passed. All day tasks sort first within a day (minute -1), so
+      // starting today's range at minute 0 skips them.
+      int beforeToday = dueIndexLowerBound(index, today, INT_MIN);
+      for (int i = 0; i < beforeToday; i++) {
+        cJSON_AddItemReferenceToArray(view->results, index->entries[i]->json);
+      }
+      start = dueIndexLowerBound(index, today, 0);
+      end = dueIndexLowerBound(index, today, nowMinute);
+    } else {
+      start = dueIndexLowerBound(index, today, INT_MIN);
+      end = dueIndexLowerBound(index, today + only->number, INT_MIN);
+    }
+    for (int i = start; i < end; i++) {
+      cJSON_AddItemReferenceToArray(view->results, index->entries[i]->json);
+    }
+    return view->results;
+  }
+
+  resolveFilterProjects(view->program,
+                        projects != NULL ? projects->json : NULL);
+  int stack[view->program->stackDepth + 1];
+  for (int i = 0; i < taskCache.length; i++) {
+    if (runFilterProgram(view->program, taskCache.tasks[i], today, nowMinute,
+                         stack)) {
+      cJSON_AddItemReferenceToArray(view->results, taskCache.tasks[i]->json);
+    }
+  }
+  return view->results;
+}
+
+// Days since 1970-01-01 for a Gregorian date. This is Howard Hinnant's
+// days_from_civil, which avoids any timezone handling in the C library.
+static int daysFromCivil(int year, int month, int day) {
+  year -= month <= 2;
+  int era = (year >= 0 ? year : year - 399) / 400;
+  int yearOfEra = year - era * 400;
+  int dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+  return era * 146097 + dayOfEra - 719468;
+}
+
+void getLocalDayMinute(int *day, int *minute) {
+  time_t now = time(NULL);
+  struct tm date;
+  localtime_r(&now, &date);
+  *day = daysFromCivil(date.tm_year + 1900, date.tm_mon + 1, date.tm_mday);
+  *minute = date.tm_hour * 60 + date.tm_min;
+}
+
+void decodeTaskDue(cJSON *task, int *day, int *minute) {
+  *day = NO_DUE_DAY;
+  *minute = -1;
+
+  // The REST API splits timed tasks out into "datetime", the Sync API keeps
+  // everything in "date"
+  cJSON *due = cJSON_GetObjectItemCaseSensitive(task, "due");
+  char *date =
+      cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(due, "datetime"));
+  if (date == NULL) {
+    date = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(due, "date"));
+  }
+  if (date == NULL) {
+    return;
+  }
+
+  int year, month, dayOfMonth, hour, minuteOfHour;
+  int fields = sscanf(date, "%d-%d-%dT%d:%d", &year, &month, &dayOfMonth,
+                      &hour, &minuteOfHour);
+  if (fields < 3) {
+    return;
+  }
+  if (fields < 5) {
+    *day = daysFromCivil(year, month, dayOfMonth);
+    return;
+  }
+
+  // A trailing Z means a fixed UTC time, anything else is floating local time
+  if (date[strlen(date) - 1] == 'Z') {
+    struct tm utc = {0};
+    utc.tm_year = year - 1900;
+    utc.tm_mon = month - 1;
+    utc.tm_mday = dayOfMonth;
+    utc.tm_hour = hour;
+    utc.tm_min = minuteOfHour;
+    time_t instant = timegm(&utc);
+    struct tm local;
+    localtime_r(&instant, &local);
+    year = local.tm_year + 1900;
+    month = local.tm_mon + 1;
+    dayOfMonth = local.tm_mday;
+    hour = local.tm_hour;
+    minuteOfHour = local.tm_min;
+  }
+  *day = daysFromCivil(year, month, dayOfMonth);
+  *minute = hour * 60 + minuteOfHour;
+}
+
+static int compareDueKeys(int day, int minute, struct cachedTask *task) {
+  if (day != task->dueDay) {
+    return day < task->dueDay ? -1 : 1;
+  }
+  if (minute != task->dueMinute) {
+    return minute < task->dueMinute ? -1 : 1;
+  }
+  return 0;
+}
+
+int dueIndexLowerBound(struct dueIndex *index, int day, int minute) {
+  int low = 0;
+  int high = index->length;
+  while (low < high) {
+    int middle = low + (high - low) / 2;
+    if (compareDueKeys(day, minute, index->entries[middle]) > 0) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+int dueIndexInsert(struct dueIndex *index, struct cachedTask *task) {
+  if (task->dueDay == NO_DUE_DAY) {
+    return 1;
+  }
+  if (index->length == index->capacity) {
+    int newCapacity = index->capacity == 0 ? 64 : index->capacity * 2;
+    struct cachedTask **newEntries =
+        realloc(index->entries, newCapacity * sizeof(struct cachedTask *));
+    if (newEntries == NULL) {
+      return 0;
+    }
+    index->entries = newEntries;
+    index->capacity = newCapacity;
+  }
+
+  // Insert after anything with the same key, so ties keep arrival order
+  int position = dueIndexLowerBound(index, task->dueDay, task->dueMinute);
+  while (position < index->length &&
+         compareDueKeys(task->dueDay, task->dueMinute,
+                        index->entries[position]) == 0) {
+    position++;
+  }
+  memmove(&index->entries[position + 1], &index->entries[position],
+          (index->length - position) * sizeof(struct cachedTask *));
+  index->entries[position] = task;
+  index->length++;
+  return 1;
+}
+
+void dueIndexRemove(struct dueIndex *index, struct cachedTask *task) {
+  if (task->dueDay == NO_DUE_DAY) {
+    return;
+  }
+  int position = dueIndexLowerBound(index, task->dueDay, task->dueMinute);
+  while (position < index->length && index->entries[position] != task) {
+    position++;
+  }
+  if (position == index->length) {
+    return;
+  }
+  memmove(&index->entries[position], &index->entries[position + 1],
+          (index->length - position - 1) * sizeof(struct cachedTask *));
+  index->length--;
+}
+
+static int addToSectionList(struct cachedTask *cachedTask, int section) {
+  if (section >= taskCache.sectionTasksLength) {
+    int newLength = sectionTable.capacity;
+    struct cachedTaskList *newLists = realloc(
+        taskCache.sectionTasks, newLength * sizeof(struct cachedTaskList));
+    if (newLists == NULL) {
+      return 0;
+    }
+    memset(&newLists[taskCache.sectionTasksLength], 0,
+           (newLength - taskCache.sectionTasksLength) *
+               sizeof(struct cachedTaskList));
+    taskCache.sectionTasks = newLists;
+    taskCache.sectionTasksLength = newLength;
+  }
+
+  struct cachedTaskList *list = &taskCache.sectionTasks[section];
+  if (list->length == list->capacity) {
+    int newCapacity = list->capacity == 0 ? 8 : list->capacity * 2;
+    struct cachedTask **newTasks =
+        realloc(list->tasks, newCapacity * sizeof(struct cachedTask *));
+    if (newTasks == NULL) {
+      return 0;
+    }
+    list->tasks = newTasks;
+    list->capacity = newCapacity;
+  }
+  cachedTask->sectionSlot = list->length;
+  list->tasks[list->length++] = cachedTask;
+  return 1;
+}
+
+// Swaps the last task of the section into the hole, so this is O(1)
+static void removeFromSectionList(struct cachedTask *cachedTask) {
+  if (cachedTask->section == -1) {
+    return;
+  }
+  struct cachedTaskList *list = &taskCache.sectionTasks[cachedTask->section];
+  struct cachedTask *last = list->tasks[--list->length];
+  last->sectionSlot = cachedTask->sectionSlot;
+  list->tasks[cachedTask->sectionSlot] = last;
+  cachedTask->section = -1;
+  cachedTask->sectionSlot = -1;
+}
+
+// Decodes cachedTask->json's due date, labels and section, and puts it in the
+// due index and its section's list. On failure it's in neither, and has no
+// labels.
+static int decodeCachedTask(struct cachedTask *cachedTask) {
+  cJSON *task = cachedTask->json;
+  decodeTaskDue(task, &cachedTask->dueDay, &cachedTask->dueMinute);
+
+  // Interning can grow every other task's label set, which is fine since
+  // this one isn't in taskCache.tasks yet and is sized after
+  cJSON *label = NULL;
+  cJSON *labels = cJSON_GetObjectItemCaseSensitive(task, "labels");
+  cJSON_ArrayForEach(label, labels) {
+    if (cJSON_IsString(label)) {
+      internLabel(label->valuestring);
+    }
+  }
+  cachedTask->labels = calloc(taskCache.labelWords + 1, sizeof(uint64_t));
+  cachedTask->section = -1;
+  cachedTask->sectionSlot = -1;
+  if (cachedTask->labels == NULL) {
+    return 0;
+  }
+  cJSON_ArrayForEach(label, labels) {
+    int labelIndex =
+        cJSON_IsString(label) ? internLabel(label->valuestring) : -1;
+    if (labelIndex != -1) {
+      cachedTask->labels[labelIndex / 64] |= (uint64_t)1 << (labelIndex % 64);
+    }
+  }
+
+  char *sectionId = cJSON_GetStringValue(
+      cJSON_GetObjectItemCaseSensitive(task, "section_id"));
+  if (sectionId != NULL) {
+    cachedTask->section = internString(&sectionTable, sectionId, NULL);
+    if (cachedTask->section != -1 &&
+        !addToSectionList(cachedTask, cachedTask->section)) {
+      cachedTask->section = -1;
+    }
+  }
+
+  if (!dueIndexInsert(&taskCache.due, cachedTask)) {
+    removeFromSectionList(cachedTask);
+    free(cachedTask->labels);
+    cachedTask->labels = NULL;
+    return 0;
+  }
+  return 1;
+}
+
+// Adds an already decoded task to the end of the cache
+static int appendCachedTask(cJSON *task) {
+  if (taskCache.length == taskCache.capacity) {
+    int newCapacity = taskCache.capacity == 0 ? 64 : taskCache.capacity * 2;
+    struct cachedTask **newTasks =
+        realloc(taskCache.tasks, newCapacity * sizeof(struct cachedTask *));
+    if (newTasks == NULL) {
+      return 0;
+    }
+    taskCache.tasks = newTasks;
+    taskCache.capacity = newCapacity;
+  }
+
+  struct cachedTask *cachedTask = malloc(sizeof(struct cachedTask));
+  if (cachedTask == NULL) {
+    return 0;
+  }
+  cachedTask->json = task;
+  cachedTask->slot = taskCache.length;
+  if (!decodeCachedTask(cachedTask)) {
+    free(cachedTask);
+    return 0;
+  }
+
+  taskCache.tasks[taskCache.length++] = cachedTask;
+  stringMapPut(
+      &taskCache.ids,
+      cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(task, "id")),
+      cachedTask->slot);
+  return 1;
+}
+
+int initTaskCache(cJSON *tasksJson) {
+  if (tasksJson == NULL) {
+    return 0;
+  }
+  taskCache.json = tasksJson;
+  if (!stringMapInit(&taskCache.ids, cJSON_GetArraySize(tasksJson))) {
+    return 0;
+  }
+
+  cJSON *task = NULL;
+  cJSON_ArrayForEach(task, tasksJson) {
+    if (!appendCachedTask(task)) {
+      return 0;
+    }
+  }
+  // Built now rather than on the first '/', which would stall the UI. Without
+  // it everything else still works, search just says it's not there.
+  taskCache.search = buildSearchIndex(tasksJson);
+  taskCache.version++;
+  return 1;
+}
+
+void freeTaskCache(void) {
+  for (int i = 0; i < taskCache.length; i++) {
+    free(taskCache.tasks[i]->labels);
+    free(taskCache.tasks[i]);
+  }
+  for (int i = 0; i < taskCache.sectionTasksLength; i++) {
+    free(taskCache.sectionTasks[i].tasks);
+  }
+  free(taskCache.sectionTasks);
+  free(taskCache.tasks);
+  free(taskCache.due.entries);
+  stringMapFree(&taskCache.ids);
+  freeSearchIndex(taskCache.search);
+  freeInternTable(&taskCache.projects);
+  free(taskCache.projectVersions);
+  cJSON_Delete(taskCache.json);
+  memset(&taskCache, 0, sizeof(taskCache));
+}
+
+// Moves the cache's version on, and that of task's project. While a refresh
+// is applying its changes, that's only once for all of them.
+static void bumpTaskVersion(cJSON *task) {
+  unsigned long next = taskCache.version + 1;
+  if (taskCache.applying) {
+    taskCache.applied = 1;
+  } else {
+    taskCache.version = next;
+  }
+  int project =
+      internString(&taskCache.projects,
+                   cJSON_GetStringValue(
+                       cJSON_GetObjectItemCaseSensitive(task, "project_id")),
+                   NULL);
+  if (project == -1) {
+    return;
+  }
+  if (project >= taskCache.projectVersionsCapacity) {
+    int newCapacity = taskCache.projects.capacity;
+    unsigned long *newVersions = realloc(
+        taskCache.projectVersions, newCapacity * sizeof(unsigned long));
+    if (newVersions == NULL) {
+      return;
+    }
+    memset(newVersions + taskCache.projectVersionsCapacity, 0,
+           (newCapacity - taskCache.projectVersionsCapacity) *
+               sizeof(unsigned long));
+    taskCache.projectVersions = newVersions;
+    taskCache.projectVersionsCapacity = newCapacity;
+  }
+  taskCache.projectVersions[project] = next;
+}
+
+unsigned long viewVersion(const char *key) {
+  size_t prefixLength = strlen(FILTER_VIEW_ID_PREFIX);
+  if (strncmp(key, FILTER_VIEW_ID_PREFIX, prefixLength) == 0) {
+    if (refresher.projects == NULL) {
+      return taskCache.version;
+    }
+    struct filterView *view =
+        &refresher.projects->filterViews[atoi(key + prefixLength)];
+    getFilterResults(view);
+    return view->generation;
+  }
+  int project = lookupInterned(&taskCache.projects, key);
+  return project == -1 || project >= taskCache.projectVersionsCapacity
+             ? 0
+             : taskCache.projectVersions[project];
+}
+
+static struct cachedTask *findCachedTask(const char *id) {
+  int slot = stringMapGet(&taskCache.ids, id);
+  return slot == -1 ? NULL : taskCache.tasks[slot];
+}
+
+void cacheSetTaskDue(const char *id, const char *date) {
+  struct cachedTask *cachedTask = findCachedTask(id);
+  if (cachedTask == NULL) {
+    return;
+  }
+
+  // Take it out under its old key before the JSON changes
+  dueIndexRemove(&taskCache.due, cachedTask);
+
+  cJSON *task = cachedTask->json;
+  cJSON *due = cJSON_GetObjectItemCaseSensitive(task, "due");
+  if (!cJSON_IsObject(due)) {
+    cJSON_DeleteItemFromObjectCaseSensitive(task, "due");
+    due = cJSON_AddObjectToObject(task, "due");
+  }
+  cJSON_DeleteItemFromObjectCaseSensitive(due, "date");
+  cJSON_DeleteItemFromObjectCaseSensitive(due, "datetime");
+  cJSON_AddStringToObject(due, "date", date);
+
+  decodeTaskDue(task, &cachedTask->dueDay, &cachedTask->dueMinute);
+  dueIndexInsert(&taskCache.due, cachedTask);
+  bumpTaskVersion(task);
+}
+
+// Takes cachedTask out of taskCache.tasks and frees it, once it's out of
+// every index
+static void dropCachedTask(struct cachedTask *cachedTask) {
+  // Swap the last task into the hole so removal stays O(1)
+  int slot = cachedTask->slot;
+  struct cachedTask *last = taskCache.tasks[--taskCache.length];
+  if (last != cachedTask) {
+    last->slot = slot;
+    taskCache.tasks[slot] = last;
+    stringMapPut(&taskCache.ids,
+                 cJSON_GetStringValue(
+                     cJSON_GetObjectItemCaseSensitive(last->json, "id")),
+                 slot);
+  }
+  cJSON_Delete(cJSON_DetachItemViaPointer(taskCache.json, cachedTask->json));
+  free(cachedTask->labels);
+  free(cachedTask);
+}
+
+void cacheRemoveTask(const char *id) {
+  struct cachedTask *cachedTask = findCachedTask(id);
+  if (cachedTask == NULL) {
+    return;
+  }
+  dueIndexRemove(&taskCache.due, cachedTask);
+  stringMapRemove(&taskCache.ids, id);
+  removeFromSectionList(cachedTask);
+  searchIndexRemove(taskCache.search, cachedTask->json);
+  bumpTaskVersion(cachedTask->json);
+  dropCachedTask(cachedTask);
+}
+
+int cacheUpdateTask(cJSON *task) {
+  char *id = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(task, "id"));
+  struct cachedTask *cachedTask = id == NULL ? NULL : findCachedTask(id);
+  if (cachedTask == NULL) {
+    cacheAddTask(task);
+    return task != NULL;
+  }
+  if (cJSON_Compare(cachedTask->json, task, true)) {
+    cJSON_Delete(task);
+    return 0;
+  }
+
+  // Out of everything under its old fields (and project), then back in under
+  // the new ones, keeping its slot
+  dueIndexRemove(&taskCache.due, cachedTask);
+  removeFromSectionList(cachedTask);
+  searchIndexRemove(taskCache.search, cachedTask->json);
+  stringMapRemove(&taskCache.ids, id);
+  bumpTaskVersion(cachedTask->json);
+  cJSON_ReplaceItemViaPointer(taskCache.json, cachedTask->json, task);
+  cachedTask->json = task;
+  free(cachedTask->labels);
+  stringMapPut(&taskCache.ids, id, cachedTask->slot);
+  if (!decodeCachedTask(cachedTask)) {
+    stringMapRemove(&taskCache.ids, id);
+    dropCachedTask(cachedTask);
+    return 1;
+  }
+  searchIndexAdd(taskCache.search, task);
+  bumpTaskVersion(task);
+  return 1;
+}
+
+void cacheBeginChanges(void) { taskCache.applying = 1; }
+
+void cacheEndChanges(void) {
+  taskCache.applying = 0;
+  if (taskCache.applied) {
+    taskCache.version++;
+    taskCache.applied = 0;
+  }
+}
+
+void cacheAddTask(cJSON *task) {
+  if (task == NULL) {
+    return;
+  }
+  cJSON_AddItemToArray(taskCache.json, task);
+  if (!appendCachedTask(task)) {
+    cJSON_Delete(cJSON_DetachItemViaPointer(taskCache.json, task));
+    return;
+  }
+  // A task search can't find is better than no task at all
+  searchIndexAdd(taskCache.search, task);
+  bumpTaskVersion(task);
+}
+
+// Packs length (1 to 3) lowercase bytes into one int. The length goes in the
+// top byte, so "ab" and "\0ab" don't collide.
+static int packGram(const char *text, int length) {
+  int gram = length << 24;
+  for (int i = 0; i < length; i++) {
+    gram |= (unsigned char)text[i] << (8 * (length - 1 - i));
+  }
+  return gram;
+}
+
+// Returns the posting list for gram, creating it if create is set. NULL if
+// there isn't one.
+static struct postingList *getPostingList(struct searchIndex *index, int gram,
+                                          int create) {
+  int mask = index->gramsCapacity - 1;
+  int i = (gram * 2654435761u) & mask;
+  while (index->grams[i] != 0) {
+    if (index->grams[i] == gram + 1) {
+      return &index->postings[index->gramLists[i]];
+    }
+    i = (i + 1) & mask;
+  }
+  if (!create) {
+    return NULL;
+  }
+
+  // Grow at 50% load, rehashing into a bigger table
+  if ((index->gramsLength + 1) * 2 > index->gramsCapacity) {
+    int newCapacity = index->gramsCapacity * 2;
+    int *newGrams = calloc(newCapacity, sizeof(int));
+    int *newLists = malloc(newCapacity * sizeof(int));
+    if (newGrams == NULL || newLists == NULL) {
+      free(newGrams);
+      free(newLists);
+      return NULL;
+    }
+    for (int j = 0; j < index->gramsCapacity; j++) {
+      if (index->grams[j] == 0) {
+        continue;
+      }
+      int k = ((index->grams[j] - 1) * 2654435761u) & (newCapacity - 1);
+      while (newGrams[k] != 0) {
+        k = (k + 1) & (newCapacity - 1);
+      }
+      newGrams[k] = index->grams[j];
+      newLists[k] = index->gramLists[j];
+    }
+    free(index->grams);
+    free(index->gramLists);
+    index->grams = newGrams;
+    index->gramLists = newLists;
+    index->gramsCapacity = newCapacity;
+    return getPostingList(index, gram, create);
+  }
+
+  if (index->postingsLength == index->postingsCapacity) {
+    int newCapacity = index->postingsCapacity * 2;
+    struct postingList *newPostings =
+        realloc(index->postings, newCapacity * sizeof(struct postingList));
+    if (newPostings == NULL) {
+      return NULL;
+    }
+    index->postings = newPostings;
+    index->postingsCapacity = newCapacity;
+  }
+  index->grams[i] = gram + 1;
+  index->gramLists[i] = index->postingsLength;
+  index->gramsLength++;
+  struct postingList *list = &index->postings[index->postingsLength++];
+  *list = (struct postingList){.docs = NULL};
+  return list;
+}
+
+// Forgets the last query, which is needed whenever the docs change
+static void resetLastSearch(struct searchIndex *index) {
+  free(index->lastQuery);
+  index->lastQuery = NULL;
+  index->lastResultsLength = 0;
+}
+
+struct searchIndex *buildSearchIndex(cJSON *tasksJson) {
+  struct searchIndex *index = calloc(1, sizeof(struct searchIndex));
+  if (index == NULL) {
+    return NULL;
+  }
+  int tasksLength = cJSON_GetArraySize(tasksJson);
+  index->gramsCapacity = 1024;
+  index->grams = calloc(index->gramsCapacity, sizeof(int));
+  index->gramLists = malloc(index->gramsCapacity * sizeof(int));
+  index->postingsCapacity = 512;
+  index->postings =
+      malloc(index->postingsCapacity * sizeof(struct postingList));
+  if (index->grams == NULL || index->gramLists == NULL ||
+      index->postings == NULL || !stringMapInit(&index->ids, tasksLength)) {
+    freeSearchIndex(index);
+    return NULL;
+  }
+
+  cJSON *task = NULL;
+  cJSON_ArrayForEach(task, tasksJson) {
+    if (!searchIndexAdd(index, task)) {
+      freeSearchIndex(index);
+      return NULL;
+    }
+  }
+  return index;
+}
+
+void freeSearchIndex(struct searchIndex *index) {
+  if (index == NULL) {
+    return;
+  }
+  for (int i = 0; i < index->docsLength; i++) {
+    free(index->docs[i].text);
+  }
+  for (int i = 0; i < index->postingsLength; i++) {
+    free(index->postings[i].docs);
+  }
+  free(index->docs);
+  free(index->grams);
+  free(index->gramLists);
+  free(index->postings);
+  free(index->lastQuery);
+  free(index->lastResults);
+  stringMapFree(&index->ids);
+  free(index);
+}
+
+int searchIndexAdd(struct searchIndex *index, cJSON *task) {
+  if (index == NULL) {
+    return 1;
+  }
+  char *id = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(task, "id"));
+  char *content =
+      cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(task, "content"));
+  char *description = cJSON_GetStringValue(
+      cJSON_GetObjectItemCaseSensitive(task, "description"));
+  if (id == NULL || content == NULL) {
+    return 1;
+  }
+  if (description == NULL) {
+    description = "";
+  }
+  // A task that's already there is replaced rather than left behind
+  searchIndexRemove(index, task);
+
+  if (index->docsLength == index->docsCapacity) {
+    int newCapacity = index->docsCapacity == 0 ? 64 : index->docsCapacity * 2;
+    struct searchDoc *newDocs =
+        realloc(index->docs, newCapacity * sizeof(struct searchDoc));
+    if (newDocs == NULL) {
+      return 0;
+    }
+    index->docs = newDocs;
+    index->docsCapacity = newCapacity;
+  }
+
+  // Content and description are joined with a newline, which can't be typed
+  // into a query, so no match can straddle the two
+  char *text = combineString(content, "\n");
+  char *fullText = text == NULL ? NULL : combineString(text, description);
+  free(text);
+  if (fullText == NULL) {
+    return 0;
+  }
+  for (char *c = fullText; *c; c++) {
+    *c = tolower((unsigned char)*c);
+  }
+
+  int doc = index->docsLength++;
+  index->docs[doc] = (struct searchDoc){.json = task, .text = fullText};
+  stringMapPut(&index->ids, id, doc);
+
+  for (int i = 0; fullText[i]; i++) {
+    for (int length = 1; length <= 3 && fullText[i + length - 1]; length++) {
+      struct postingList *list =
+          getPostingList(index, packGram(&fullText[i], length), 1);
+      if (list == NULL) {
+        return 0;
+      }
+      // The same gram can turn up more than once in a task
+      if (list->length > 0 && list->docs[list->length - 1] == doc) {
+        continue;
+      }
+      if (list->length == list->capacity) {
+        int newCapacity = list->capacity == 0 ? 4 : list->capacity * 2;
+        int *newDocs = realloc(list->docs, newCapacity * sizeof(int));
+        if (newDocs == NULL) {
+          return 0;
+        }
+        list->docs = newDocs;
+        list->capacity = newCapacity;
+      }
+      list->docs[list->length++] = doc;
+    }
+  }
+
+  resetLastSearch(index);
+  return 1;
+}
+
+// Every update removes a doc and adds another, so without this the docs and
+// posting lists would grow with each refresh. Live docs move down into the
+// removed ones' slots, in the same order, so the lists stay sorted.
+static void compactSearchIndex(struct searchIndex *index) {
+  int *newDocs = malloc(index->docsLength * sizeof(int));
+  if (newDocs == NULL) {
+    return;
+  }
+  int docsLength = 0;
+  for (int i = 0; i < index->docsLength; i++) {
+    if (index->docs[i].text == NULL) {
+      newDocs[i] = -1;
+      continue;
+    }
+    newDocs[i] = docsLength;
+    index->docs[docsLength] = index->docs[i];
+    stringMapPut(&index->ids,
+                 cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(
+                     index->docs[docsLength].json, "id")),
+                 docsLength);
+    docsLength++;
+  }
+  index->docsLength = docsLength;
+  index->removed = 0;
+
+  for (int i = 0; i < index->postingsLength; i++) {
+    struct postingList *list = &index->postings[i];
+    int length = 0;
+    for (int j = 0; j < list->length; j++) {
+      if (newDocs[list->docs[j]] != -1) {
+        list->docs[length++] = newDocs[list->docs[j]];
+      }
+    }
+    list->length = length;
+  }
+  free(newDocs);
+}
+
+void searchIndexRemove(struct searchIndex *index, cJSON *task) {
+  if (index == NULL) {
+    return;
+  }
+  char *id = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(task, "id"));
+  int doc = stringMapGet(&index->ids, id);
+  if (doc == -1) {
+    return;
+  }
+
+  // Posting lists keep the doc id, queries just skip docs without text
+  stringMapRemove(&index->ids, id);
+  free(index->docs[doc].text);
+  index->docs[doc] = (struct searchDoc){.json = NULL};
+  index->removed++;
+  resetLastSearch(index);
+  if (index->removed >= 64 && index->removed * 2 > index->docsLength) {
+    compactSearchIndex(index);
+  }
+}
+
+// First position in list that's >= doc, galloping from start so intersecting
+// a short list with a long one doesn't walk the long one
+static int gallopPostingList(struct postingList *list, int start, int doc) {
+  int step = 1;
+  int high = start;
+  while (high < list->length && list->docs[high] < doc) {
+    start = high + 1;
+    high += step;
+    step *= 2;
+  }
+  if (high > list->length) {
+    high = list->length;
+  }
+  while (start < high) {
+    int middle = start + (high - start) / 2;
+    if (list->docs[middle] < doc) {
+      start = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return start;
+}
+
+static int comparePostingLengths(const void *a, const void *b) {
+  return (*(struct postingList **)a)->length -
+         (*(struct postingList **)b)->length;
+}
+
+int searchIndexQuery(struct searchIndex *index, const char *query,
+                     int **results) {
+  int queryLength = strlen(query);
+  char lowerQuery[queryLength + 1];
+  for (int i = 0; i <= queryLength; i++) {
+    lowerQuery[i] = tolower((unsigned char)query[i]);
+  }
+
+  // Either re-check the previous results, or the docs the grams point to. A
+  // query shorter than a trigram is a gram of its own.
+  int *candidates = NULL;
+  int candidatesLength = 0;
+  int gramLength = queryLength < 3 ? queryLength : 3;
+  struct postingList *lists[queryLength > 2 ? queryLength - 2 : 1];
+  int listsLength = 0;
+
+  if (index->lastQuery != NULL &&
+      strncmp(lowerQuery, index->lastQuery, strlen(index->lastQuery)) == 0) {
+    candidates = index->lastResults;
+    candidatesLength = index->lastResultsLength;
+  } else if (queryLength > 0) {
+    for (int i = 0; i + gramLength <= queryLength; i++) {
+      struct postingList *list =
+          getPostingList(index, packGram(&lowerQuery[i], gramLength), 0);
+      if (list == NULL) {
+        candidatesLength = 0;
+        listsLength = -1;
+        break;
+      }
+      lists[listsLength++] = list;
+    }
+    if (listsLength > 0) {
+      qsort(lists, listsLength, sizeof(struct postingList *),
+            comparePostingLengths);
+      candidates = lists[0]->docs;
+      candidatesLength = lists[0]->length;
+    }
+  }
+
+  // Results are written over lastResults in place, which is safe when it's
+  // also the candidate list since we never write ahead of what we've read
+  if (candidates != index->lastResults) {
+    int *newResults =
+        realloc(index->lastResults, (candidatesLength + 1) * sizeof(int));
+    if (newResults == NULL) {
+      return 0;
+    }
+    index->lastResults = newResults;
+  }
+
+  int *positions = listsLength > 1 ? calloc(listsLength, sizeof(int)) : NULL;
+  int length = 0;
+  for (int i = 0; i < candidatesLength; i++) {
+    int doc = candidates[i];
+    if (index->docs[doc].text == NULL) {
+      continue;
+    }
+
+    // Every other gram has to contain this doc too
+    int inAll = 1;
+    for (int j = 1; j < listsLength && positions != NULL; j++) {
+      positions[j] = gallopPostingList(lists[j], positions[j], doc);
+      if (positions[j] == lists[j]->length ||
+          lists[j]->docs[positions[j]] != doc) {
+        inAll = 0;
+        break;
+      }
+    }
+
+    // Grams can all be there without being next to each other
+    if (inAll && strstr(index->docs[doc].text, lowerQuery) != NULL) {
+      index->lastResults[length++] = doc;
+    }
+  }
+  free(positions);
+
+  free(index->lastQuery);
+  index->lastQuery = strdup(lowerQuery);
+  index->lastResultsLength = length;
+  *results = index->lastResults;
+  return length;
+}
+
+void startTaskSearch(struct taskView *view) {
+  if (taskCache.search == NULL) {
+    showTaskNotice(view, "Search isn't available without its index.");
+    return;
+  }
+  view->searching = calloc(1, sizeof(struct taskSearch));
+}
+
+// Puts the status line back, and leaves the list the way it is
+static void endTaskSearch(struct taskView *view) {
+  free(view->searching);
+  view->searching = NULL;
+  werase(view->status);
+}
+
+void answerTaskSearch(struct taskView *view, int key) {
+  struct taskSearch *search = view->searching;
+  if (key == 27) {
+    // Escape puts the whole list back, with the cursor where it was
+    resetVisibleTasks(view->tree);
+    view->list.top = view->tree->firstVisible;
+    settleTaskCursor(view);
+    drawTaskRows(view, 0, view->list.height);
+    endTaskSearch(view);
+  } else if (key == KEY_ENTER || key == '\n' || key == '\r') {
+    // What's been typed since the last frame still counts
+    runTaskSearch(view);
+    endTaskSearch(view);
+  } else if (key == KEY_BACKSPACE || key == 127 || key == 8) {
+    if (search->queryLength > 0) {
+      search->query[--search->queryLength] = '\0';
+      search->changed = 1;
+    }
+  } else if (key >= ' ' && key < 256 &&
+             search->queryLength < (int)sizeof(search->query) - 1) {
+    search->query[search->queryLength++] = key;
+    search->query[search->queryLength] = '\0';
+    search->changed = 1;
+  }
+}
+
+void runTaskSearch(struct taskView *view) {
+  struct taskSearch *search = view->searching;
+  if (search == NULL || !search->changed) {
+    return;
+  }
+
+  // Nothing typed is everything, the way it was before the search
+  if (search->queryLength == 0) {
+    resetVisibleTasks(view->tree);
+  } else {
+    int *nodes = malloc((view->tree->length + 1) * sizeof(int));
+    if (nodes == NULL) {
+      return;
+    }
+
+    // The index covers every cached task, so only the ones in this view's
+    // tree are kept
+    int *docs = NULL;
+    int docsLength = searchIndexQuery(taskCache.search, search->query, &docs);
+    int nodesLength = 0;
+    for (int i = 0; i < docsLength && nodesLength < view->tree->length; i++) {
+      char *id = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(
+          taskCache.search->docs[docs[i]].json, "id"));
+      int node = stringMapGet(&view->tree->ids, id);
+      if (node != -1) {
+        nodes[nodesLength++] = node;
+      }
+    }
+    showOnlyTasks(view->tree, nodes, nodesLength);
+    free(nodes);
+  }
+  search->changed = 0;
+
+  view->list.top = view->tree->firstVisible;
+  view->list.cursor = -1;
+  settleTaskCursor(view);
+  drawTaskRows(view, 0, view->list.height);
+}
+
+int internString(struct internTable *table, const char *key, const char *name) {
+  int existing = lookupInterned(table, key);
+  if (existing != -1) {
+    // Sections seen on a task before the sections endpoint get named later
+    if (name != NULL && table->names[existing] == NULL) {
+      table->names[existing] = strdup(name);
+    }
+    return existing;
+  }
+  if (key == NULL) {
+    return -1;
+  }
+
+  if (table->length == table->capacity) {
+    int newCapacity = table->capacity == 0 ? 16 : table->capacity * 2;
+    char **newKeys = realloc(table->keys, newCapacity * sizeof(char *));
+    if (newKeys == NULL) {
+      return -1;
+    }
+    table->keys = newKeys;
+    char **newNames = realloc(table->names, newCapacity * sizeof(char *));
+    if (newNames == NULL) {
+      return -1;
+    }
+    table->names = newNames;
+    table->capacity = newCapacity;
+  }
+  if (table->ids.capacity == 0 && !stringMapInit(&table->ids, 16)) {
+    return -1;
+  }
+
+  char *ownedKey = strdup(key);
+  if (ownedKey == NULL) {
+    return -1;
+  }
+  table->keys[table->length] = ownedKey;
+  table->names[table->length] = name == NULL ? NULL : strdup(name);
+  if (!stringMapPut(&table->ids, ownedKey, table->length)) {
+    free(ownedKey);
+    free(table->names[table->length]);
+    return -1;
+  }
+  return table->length++;
+}
+
+int lookupInterned(struct internTable *table, const char *key) {
+  return stringMapGet(&table->ids, key);
+}
+
+void freeInternTable(struct internTable *table) {
+  for (int i = 0; i < table->length; i++) {
+    free(table->keys[i]);
+    free(table->names[i]);
+  }
+  free(table->keys);
+  free(table->names);
+  stringMapFree(&table->ids);
+  memset(table, 0, sizeof(struct internTable));
+}
+
+int internLabel(const char *name) {
+  if (name == NULL) {
+    return -1;
+  }
+  size_t length = strlen(name);
+  char key[length + 1];
+  for (size_t i = 0; i <= length; i++) {
+    key[i] = tolower((unsigned char)name[i]);
+  }
+
+  int label = internString(&labelTable, key, name);
+  if (label == -1) {
+    return -1;
+  }
+
+  // Every set needs to be able to hold the new label
+  int words = label / 64 + 1;
+  if (words > taskCache.labelWords) {
+    for (int i = 0; i < taskCache.length; i++) {
+      uint64_t *newLabels =
+          realloc(taskCache.tasks[i]->labels, words * sizeof(uint64_t));
+      if (newLabels == NULL) {
+        return -1;
+      }
+      memset(&newLabels[taskCache.labelWords], 0,
+             (words - taskCache.labelWords) * sizeof(uint64_t));
+      taskCache.tasks[i]->labels = newLabels;
+    }
+    taskCache.labelWords = words;
+  }
+  return label;
+}
+
+void internLabelsAndSections(cJSON *labelsJson, cJSON *sectionsJson) {
+  cJSON *entry = NULL;
+  cJSON_ArrayForEach(entry, labelsJson) {
+    internLabel(
+        cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(entry, "name")));
+  }
+  cJSON_ArrayForEach(entry, sectionsJson) {
+    internString(
+        &sectionTable,
+        cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(entry, "id")),
+        cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(entry, "name")));
+  }
+}
+
+static long long monotonicMs(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+// Points the timerfd at whichever timer is due first, or disarms it
+static void armTimerFd(void) {
+  long long earliest = LLONG_MAX;
+  for (int i = 0; i < eventLoop.timersLength; i++) {
+    if (eventLoop.timers[i].deadline < earliest) {
+      earliest = eventLoop.timers[i].deadline;
+    }
+  }
+
+  struct itimerspec spec = {0};
+  if (earliest != LLONG_MAX) {
+    spec.it_value.tv_sec = earliest / 1000;
+    spec.it_value.tv_nsec = (earliest % 1000) * 1000000;
+    // All zeroes would disarm it
+    if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+      spec.it_value.tv_nsec = 1;
+    }
+  }
+  timerfd_settime(eventLoop.timerFd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+int addTimer(long long delay, void (*handler)(void *data), void *data) {
+  if (eventLoop.timersLength == eventLoop.timersCapacity) {
+    int capacity = eventLoop.timersCapacity ? eventLoop.timersCapacity * 2 : 8;
+    struct eventTimer *timers =
+        realloc(eventLoop.timers, capacity * sizeof(struct eventTimer));
+    if (timers == NULL) {
+      return -1;
+    }
+    eventLoop.timers = timers;
+    eventLoop.timersCapacity = capacity;
+  }
+
+  int id = ++eventLoop.nextTimerId;
+  eventLoop.timers[eventLoop.timersLength++] =
+      (struct eventTimer){.id = id,
+                          .deadline = monotonicMs() + delay,
+                          .handler = handler,
+                          .data = data};
+  armTimerFd();
+  return id;
+}
+
+void cancelTimer(int id) {
+  for (int i = 0; i < eventLoop.timersLength; i++) {
+    if (eventLoop.timers[i].id == id) {
+      eventLoop.timers[i] = eventLoop.timers[--eventLoop.timersLength];
+      armTimerFd();
+      return;
+    }
+  }
+}
+
+int watchFd(int fd, unsigned int events,
+            void (*handler)(int fd, unsigned int events, void *data),
+            void *data) {
+  if (fd >= eventLoop.sourcesLength) {
+    int length = eventLoop.sourcesLength ? eventLoop.sourcesLength : 16;
+    while (length <= fd) {
+      length *= 2;
+    }
+    struct eventSource *sources =
+        realloc(eventLoop.sources, length * sizeof(struct eventSource));
+    if (sources == NULL) {
+      return 0;
+    }
+    memset(sources + eventLoop.sourcesLength, 0,
+           (length - eventLoop.sourcesLength) * sizeof(struct eventSource));
+    eventLoop.sources = sources;
+    eventLoop.sourcesLength = length;
+  }
+
+  // Sockets can be closed and their number reused without being unwatched
+  // first, so fall back to adding if there's nothing to modify
+  struct epoll_event event = {.events = events, .data.fd = fd};
+  if (eventLoop.sources[fd].handler == NULL ||
+      epoll_ctl(eventLoop.epoll, EPOLL_CTL_MOD, fd, &event) == -1) {
+    if (epoll_ctl(eventLoop.epoll, EPOLL_CTL_ADD, fd, &event) == -1) {
+      return 0;
+    }
+  }
+  eventLoop.sources[fd] =
+      (struct eventSource){.handler = handler, .data = data, .events = events};
+  return 1;
+}
+
+void unwatchFd(int fd) {
+  if (fd < 0 || fd >= eventLoop.sourcesLength ||
+      eventLoop.sources[fd].handler == NULL) {
+    return;
+  }
+  epoll_ctl(eventLoop.epoll, EPOLL_CTL_DEL, fd, NULL);
+  eventLoop.sources[fd].handler = NULL;
+}
+
+static void handleTimerFd(int fd, unsigned int events, void *data) {
+  uint64_t expirations;
+  if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+    return;
+  }
+
+  // Handlers can add and cancel timers, so go one at a time, and leave timers
+  // added while this runs for the next round
+  long long now = monotonicMs();
+  int lastId = eventLoop.nextTimerId;
+  int i = 0;
+  while (i < eventLoop.timersLength) {
+    struct eventTimer timer = eventLoop.timers[i];
+    if (timer.deadline > now || timer.id > lastId) {
+      i++;
+      continue;
+    }
+    eventLoop.timers[i] = eventLoop.timers[--eventLoop.timersLength];
+    timer.handler(timer.data);
+    i = 0;
+  }
+  armTimerFd();
+}
+
+static void handleSignalFd(int fd, unsigned int events, void *data) {
+  struct signalfd_siginfo info;
+  while (read(fd, &info, sizeof(info)) == sizeof(info)) {
+    eventLoop.pendingResize = 1;
+  }
+}
+
+static void handleTty(int fd, unsigned int events, void *data) {
+  // Whoever's waiting for a key (waitForKey) reads it themselves
+  if (eventLoop.modal > 0) {
+    return;
+  }
+
+  // Hand over every key that's ready. The view can change under us (opening a
+  // project runs a nested loop with its own view), so look it up every time.
+  while (!eventLoop.stopped && eventLoop.view.onKey != NULL) {
+    int key = wgetch(eventLoop.input);
+    if (key == ERR) {
+      break;
+    }
+    noteActivity();
+    eventLoop.view.onKey(key, eventLoop.view.data);
+  }
+}
+
+// Adds one to an eventfd's counter, waking whoever's watching it. EAGAIN
+// means the counter's full, so it's signalled already.
+static void signalEventFd(int fd) {
+  uint64_t one = 1;
+  while (write(fd, &one, sizeof(one)) == -1 && errno == EINTR) {
+  }
+}
+
+// Resets an eventfd's counter once its wakeup has been seen. EAGAIN means
+// another read got to it first, which is just as good.
+static void clearEventFd(int fd) {
+  uint64_t count;
+  while (read(fd, &count, sizeof(count)) == -1 && errno == EINTR) {
+  }
+}
+
+// Returns 0 if ring is full
+static int pushMessage(struct messageRing *ring,
+                       struct networkMessage message) {
+  unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  if (tail - atomic_load_explicit(&ring->head, memory_order_acquire) ==
+      NETWORK_RING_SIZE) {
+    return 0;
+  }
+  ring->slots[tail & (NETWORK_RING_SIZE - 1)] = message;
+  atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+  return 1;
+}
+
+// Returns 0 if ring is empty
+static int popMessage(struct messageRing *ring,
+                      struct networkMessage *message) {
+  unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  if (head == atomic_load_explicit(&ring->tail, memory_order_acquire)) {
+    return 0;
+  }
+  *message = ring->slots[head & (NETWORK_RING_SIZE - 1)];
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+  return 1;
+}
+
+// The network thread. Takes new requests, lets curl do whatever's ready, and
+// hands back the ones that are done, sleeping in curl_multi_poll otherwise.
+static void *runNetwork(void *data) {
+  while (!atomic_load(&eventLoop.networkStopping)) {
+    struct networkMessage message;
+    while (popMessage(&eventLoop.requests, &message)) {
+      if (curl_multi_add_handle(eventLoop.multi, message.curl) != CURLM_OK) {
+        message.result = CURLE_FAILED_INIT;
+        pushMessage(&eventLoop.completions, message);
+      }
+    }
+
+    int running;
+    curl_multi_perform(eventLoop.multi, &running);
+    CURLMsg *done;
+    int messagesLeft;
+    while ((done = curl_multi_info_read(eventLoop.multi, &messagesLeft)) !=
+           NULL) {
+      if (done->msg == CURLMSG_DONE) {
+        message = (struct networkMessage){.curl = done->easy_handle,
+                                          .result = done->data.result};
+        curl_multi_remove_handle(eventLoop.multi, message.curl);
+        pushMessage(&eventLoop.completions, message);
+      }
+    }
+
+    // One write covers everything pushed so far, however many there are
+    if (atomic_load_explicit(&eventLoop.completions.tail,
+                             memory_order_acquire) !=
+        atomic_load_explicit(&eventLoop.completions.head,
+                             memory_order_acquire)) {
+      signalEventFd(eventLoop.networkFd);
+    }
+    curl_multi_poll(eventLoop.multi, NULL, 0, 1000, NULL);
+  }
+  return NULL;
+}
+
+// Runs on the network thread, which aborts the transfer once it returns
+// non-zero
+static int checkCancelled(void *data, curl_off_t downloadTotal,
+                          curl_off_t downloaded, curl_off_t uploadTotal,
+                          curl_off_t uploaded) {
+  struct pendingRequest *request = (struct pendingRequest *)data;
+  return atomic_load_explicit(&request->cancelled, memory_order_relaxed);
+}
+
+// Puts request at the back of its class's queue, or the front if it's been
+// waiting already
+static void queueRequest(struct pendingRequest *request, int front) {
+  enum requestClass class = request->class;
+  request->state = REQUEST_QUEUED;
+  if (front) {
+    request->next = eventLoop.queued[class];
+    eventLoop.queued[class] = request;
+    if (eventLoop.queuedLast[class] == NULL) {
+      eventLoop.queuedLast[class] = request;
+    }
+    return;
+  }
+  request->next = NULL;
+  if (eventLoop.queuedLast[class] == NULL) {
+    eventLoop.queued[class] = request;
+  } else {
+    eventLoop.queuedLast[class]->next = request;
+  }
+  eventLoop.queuedLast[class] = request;
+}
+
+// Takes request out of the list starting at *first. last is the list's last
+// request, if it keeps track of it.
+static void unlinkRequest(struct pendingRequest **first,
+                          struct pendingRequest **last,
+                          struct pendingRequest *request) {
+  struct pendingRequest *previous = NULL;
+  for (struct pendingRequest *current = *first; current != NULL;
+       previous = current, current = current->next) {
+    if (current != request) {
+      continue;
+    }
+    if (previous == NULL) {
+      *first = current->next;
+    } else {
+      previous->next = current->next;
+    }
+    if (last != NULL && *last == current) {
+      *last = previous;
+    }
+    return;
+  }
+}
+
+// Hands request to the network thread. The rings can't fill up, with inFlight
+// kept below their size.
+static void sendRequest(struct pendingRequest *request) {
+  CURL *curl = request->curl;
+  atomic_store(&request->cancelled, 0);
+  curl_easy_setopt(curl, CURLOPT_PRIVATE, request);
+  curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, checkCancelled);
+  curl_easy_setopt(curl, CURLOPT_XFERINFODATA, request);
+  curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+  pushMessage(&eventLoop.requests,
+              (struct networkMessage){.curl = curl, .result = CURLE_OK});
+
+  request->state = REQUEST_RUNNING;
+  request->next = eventLoop.running;
+  eventLoop.running = request;
+  eventLoop.inFlight++;
+  if (request->class != REQUEST_INTERACTIVE) {
+    eventLoop.transfers++;
+  }
+}
+
+// Aborts the least urgent running request that's less urgent than class and
+// can start over, to make room for one of class. It goes back in its queue
+// once it's been aborted. Returns 0 if there's nothing to preempt.
+static int preemptFor(enum requestClass class) {
+  struct pendingRequest *victim = NULL;
+  for (struct pendingRequest *request = eventLoop.running; request != NULL;
+       request = request->next) {
+    if (request->class > class && request->restart != NULL &&
+        !atomic_load(&request->cancelled) &&
+        (victim == NULL || request->class > victim->class)) {
+      victim = request;
+    }
+  }
+  if (victim == NULL) {
+    return 0;
+  }
+  victim->preempted = 1;
+  atomic_store(&victim->cancelled, 1);
+  return 1;
+}
+
+// Takes a token from bucket, after topping it up for the time since it last
+// was. Returns 0 if there was one, or else how many ms until there will be.
+static long long takeToken(struct rateBucket *bucket, long long now) {
+  bucket->tokens += (now - bucket->refilled) * RATE_PER_SECOND / 1000;
+  if (bucket->tokens > RATE_BURST) {
+    bucket->tokens = RATE_BURST;
+  }
+  bucket->refilled = now;
+
+  long long wait = 0;
+  if (now < bucket->blockedUntil) {
+    wait = bucket->blockedUntil - now;
+  } else if (bucket->tokens < 1) {
+    wait = (long long)((1 - bucket->tokens) * 1000 / RATE_PER_SECOND) + 1;
+  }
+  if (wait > 0) {
+    if (bucket->waitingSince == 0) {
+      bucket->waitingSince = now;
+    }
+    return wait;
+  }
+  if (bucket->waitingSince != 0) {
+    bucket->throttledMs += now - bucket->waitingSince;
+    bucket->waitingSince = 0;
+  }
+  bucket->tokens--;
+  return 0;
+}
+
+// Empties bucket and holds it back for as long as the 429 curl got asks
+static void throttleBucket(struct rateBucket *bucket, CURL *curl) {
+  curl_off_t retryAfter = 0;
+  curl_easy_getinfo(curl, CURLINFO_RETRY_AFTER, &retryAfter);
+  long long now = monotonicMs();
+  long long until =
+      now + (retryAfter > 0 ? retryAfter * 1000LL : RATE_LIMITED_MS);
+  if (until > bucket->blockedUntil) {
+    bucket->blockedUntil = until;
+  }
+  bucket->tokens = 0;
+  bucket->refilled = now;
+  bucket->rejected++;
+}
+
+static void dispatchRequests(void);
+
+static void handleRateTimer(void *data) {
+  eventLoop.rateTimer = -1;
+  dispatchRequests();
+}
+
+// Starts whatever's queued, most urgent first, while there are transfers to
+// spare. A class left waiting holds back every class after it, and takes
+// transfers from them as they're aborted. Once a request has to wait on a
+// token, everything behind it in the same bucket waits too without asking,
+// so a class can still use the other bucket, and the loop is back once the
+// first of them has one.
+static void dispatchRequests(void) {
+  int woken = 0;
+  long long now = monotonicMs();
+  long long tokenWait = 0;
+  int bucketWaiting[BUCKETS] = {0};
+  for (int class = 0; class < REQUEST_CLASSES; class++) {
+    struct pendingRequest *request = eventLoop.queued[class];
+    int full = 0;
+    while (request != NULL) {
+      if (eventLoop.inFlight >= NETWORK_RING_SIZE - 1 ||
+          (class != REQUEST_INTERACTIVE &&
+           eventLoop.transfers >= MAX_TRANSFERS)) {
+        full = 1;
+        break;
+      }
+      struct pendingRequest *next = request->next;
+      if (bucketWaiting[request->bucket]) {
+        request = next;
+        continue;
+      }
+      long long wait = takeToken(&eventLoop.buckets[request->bucket], now);
+      if (wait > 0) {
+        bucketWaiting[request->bucket] = 1;
+        if (tokenWait == 0 || wait < tokenWait) {
+          tokenWait = wait;
+        }
+      } else {
+        unlinkRequest(&eventLoop.queued[class], &eventLoop.queuedLast[class],
+                      request);
+        sendRequest(request);
+        woken = 1;
+      }
+      request = next;
+    }
+    if (!full) {
+      continue;
+    }
+
+    // One preempted for each request still waiting, counting the ones
+    // already on their way out
+    int waiting = 0;
+    for (struct pendingRequest *request = eventLoop.queued[class];
+         request != NULL; request = request->next) {
+      waiting++;
+    }
+    for (struct pendingRequest *request = eventLoop.running; request != NULL;
+         request = request->next) {
+      waiting -= request->preempted;
+    }
+    while (waiting-- > 0 && preemptFor(class)) {
+      woken = 1;
+    }
+    break;
+  }
+  if (eventLoop.rateTimer != -1) {
+    cancelTimer(eventLoop.rateTimer);
+    eventLoop.rateTimer = -1;
+  }
+  if (tokenWait > 0) {
+    eventLoop.rateTimer = addTimer(tokenWait, handleRateTimer, NULL);
+  }
+  if (woken) {
+    curl_multi_wakeup(eventLoop.multi);
+  }
+}
+
+void promoteRequest(struct pendingRequest *request, enum requestClass class) {
+  if (class >= request->class) {
+    return;
+  }
+  if (request->state == REQUEST_ATTACHED) {
+    request->class = class;
+    promoteRequest(request->attachedTo, class);
+    return;
+  }
+  if (request->state == REQUEST_QUEUED) {
+    unlinkRequest(&eventLoop.queued[request->class],
+                  &eventLoop.queuedLast[request->class], request);
+    request->class = class;
+    queueRequest(request, 1);
+    dispatchRequests();
+    return;
+  }
+  if (request->state == REQUEST_RUNNING && class == REQUEST_INTERACTIVE) {
+    eventLoop.transfers--;
+  }
+  request->class = class;
+}
+
+// Whether a request that ended like this could well go through if it's sent
+// again. curl only fails on the HTTP status when asked to, so 5xx is CURLE_OK.
+static int isTransientFailure(CURLcode result, long status) {
+  switch (result) {
+  case CURLE_OK:
+    return status >= 500;
+  case CURLE_COULDNT_RESOLVE_HOST:
+  case CURLE_COULDNT_CONNECT:
+  case CURLE_OPERATION_TIMEDOUT:
+  case CURLE_SEND_ERROR:
+  case CURLE_RECV_ERROR:
+  case CURLE_GOT_NOTHING:
+  case CURLE_PARTIAL_FILE:
+  case CURLE_SSL_CONNECT_ERROR:
+  case CURLE_HTTP2:
+  case CURLE_HTTP2_STREAM:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+static void retryRequest(void *data) {
+  struct pendingRequest *request = (struct pendingRequest *)data;
+  request->retryTimer = -1;
+  request->restart(request->data);
+  queueRequest(request, 1);
+  dispatchRequests();
+}
+
+// Sends request again, ahead of the rest of its class. One that was rate
+// limited goes straight back in the queue, since its bucket holds it back
+// already, and anything else waits out its backoff first.
+static void retryLater(struct pendingRequest *request, int limited) {
+  eventLoop.retries++;
+  long long delay = RETRY_MS << request->attempts++;
+  if (delay > RETRY_MAX_MS) {
+    delay = RETRY_MAX_MS;
+  }
+  delay = delay / 2 + rand_r(&eventLoop.retrySeed) % (delay / 2 + 1);
+
+  request->state = REQUEST_RETRYING;
+  request->retryTimer = limited ? -1 : addTimer(delay, retryRequest, request);
+  if (request->retryTimer == -1) {
+    retryRequest(request);
+  }
+}
+
+// Calls the handlers of the requests the network thread's done with
+static void handleNetworkFd(int fd, unsigned int events, void *data) {
+  clearEventFd(fd);
+
+  struct networkMessage message;
+  while (popMessage(&eventLoop.completions, &message)) {
+    eventLoop.inFlight--;
+    struct pendingRequest *request = NULL;
+    curl_easy_getinfo(message.curl, CURLINFO_PRIVATE, (char **)&request);
+    if (request == NULL) {
+      continue;
+    }
+    unlinkRequest(&eventLoop.running, NULL, request);
+    if (request->class != REQUEST_INTERACTIVE) {
+      eventLoop.transfers--;
+    }
+
+    // Unless it managed to finish first, a preempted request waits to start
+    // over, ahead of anything else in its class
+    if (request->preempted && message.result == CURLE_ABORTED_BY_CALLBACK) {
+      request->preempted = 0;
+      request->restart(request->data);
+      queueRequest(request, 1);
+      continue;
+    }
+    // So does one that was turned away, once its bucket's allowed again, and
+    // one that failed along the way after backing off. Sending it again is
+    // safe: a Sync API command keeps its uuid, which the server won't run
+    // twice, and a REST DELETE that went through already answers 404, which
+    // finishMutation counts as done.
+    long status = 0;
+    curl_easy_getinfo(message.curl, CURLINFO_RESPONSE_CODE, &status);
+    int limited = message.result == CURLE_OK && status == 429;
+    if (limited) {
+      throttleBucket(&eventLoop.buckets[request->bucket], message.curl);
+    }
+    if ((limited || isTransientFailure(message.result, status)) &&
+        request->restart != NULL && request->attempts < RETRY_ATTEMPTS) {
+      request->preempted = 0;
+      retryLater(request, limited);
+      continue;
+    }
+    request->preempted = 0;
+    request->state = REQUEST_IDLE;
+    request->handler(message.curl, message.result, request->data);
+  }
+  dispatchRequests();
+}
+
+int initEventLoop(void) {
+  eventLoop.frameTimer = -1;
+  eventLoop.rateTimer = -1;
+  eventLoop.retrySeed = (unsigned int)time(NULL) ^ (unsigned int)getpid();
+  for (int i = 0; i < BUCKETS; i++) {
+    eventLoop.buckets[i] =
+        (struct rateBucket){.tokens = RATE_BURST, .refilled = monotonicMs()};
+  }
+  eventLoop.input = newpad(1, 1);
+  eventLoop.epoll = epoll_create1(EPOLL_CLOEXEC);
+  eventLoop.timerFd =
+      timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+  // SIGWINCH has to be blocked to be read from the signalfd, instead of
+  // interrupting whatever happens to be running
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGWINCH);
+  sigprocmask(SIG_BLOCK, &signals, NULL);
+  eventLoop.signalFd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+
+  eventLoop.networkFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  eventLoop.multi = curl_multi_init();
+  if (eventLoop.input == NULL || eventLoop.epoll == -1 ||
+      eventLoop.timerFd == -1 || eventLoop.signalFd == -1 ||
+      eventLoop.networkFd == -1 || eventLoop.multi == NULL) {
+    return 0;
+  }
+  keypad(eventLoop.input, TRUE);
+  nodelay(eventLoop.input, TRUE);
+
+  // The thread gets SIGWINCH blocked along with everything else, so it's only
+  // ever read from the signalfd
+  if (pthread_create(&eventLoop.network, NULL, runNetwork, NULL) != 0) {
+    return 0;
+  }
+  eventLoop.networkStarted = 1;
+
+  return watchFd(STDIN_FILENO, EPOLLIN, handleTty, NULL) &&
+         watchFd(eventLoop.timerFd, EPOLLIN, handleTimerFd, NULL) &&
+         watchFd(eventLoop.signalFd, EPOLLIN, handleSignalFd, NULL) &&
+         watchFd(eventLoop.networkFd, EPOLLIN, handleNetworkFd, NULL);
+}
+
+void freeEventLoop(void) {
+  if (eventLoop.networkStarted) {
+    atomic_store(&eventLoop.networkStopping, 1);
+    curl_multi_wakeup(eventLoop.multi);
+    pthread_join(eventLoop.network, NULL);
+  }
+  if (eventLoop.multi != NULL) {
+    curl_multi_cleanup(eventLoop.multi);
+  }
+  if (eventLoop.networkFd > 0) {
+    close(eventLoop.networkFd);
+  }
+  if (eventLoop.epoll > 0) {
+    close(eventLoop.epoll);
+  }
+  if (eventLoop.timerFd > 0) {
+    close(eventLoop.timerFd);
+  }
+  if (eventLoop.signalFd > 0) {
+    close(eventLoop.signalFd);
+  }
+  if (eventLoop.input != NULL) {
+    delwin(eventLoop.input);
+  }
+  free(eventLoop.sources);
+  free(eventLoop.timers);
+  memset(&eventLoop, 0, sizeof(eventLoop));
+}
+
+// Waits until something's ready, and calls its handler. Blocks for as long as
+// it takes, the timerfd being how timers wake it up.
+static void dispatchEvents(void) {
+  struct epoll_event events[16];
+  int length = epoll_wait(eventLoop.epoll, events, 16, -1);
+  for (int i = 0; i < length; i++) {
+    // An earlier handler might have unwatched it
+    int fd = events[i].data.fd;
+    if (fd < eventLoop.sourcesLength && eventLoop.sources[fd].handler != NULL) {
+      eventLoop.sources[fd].handler(fd, events[i].events,
+                                    eventLoop.sources[fd].data);
+    }
+  }
+}
+
+// While a request blocks, keys are left on the tty for later. Since epoll is
+// level triggered, the tty has to stop being watched meanwhile.
+static void muteKeys(int muted) {
+  eventLoop.keysMuted += muted ? 1 : -1;
+  struct epoll_event event = {.events = eventLoop.keysMuted > 0 ? 0 : EPOLLIN,
+                              .data.fd = STDIN_FILENO};
+  epoll_ctl(eventLoop.epoll, EPOLL_CTL_MOD, STDIN_FILENO, &event);
+}
+
+struct eventView setEventView(struct eventView view) {
+  struct eventView previous = eventLoop.view;
+  eventLoop.view = view;
+  return previous;
+}
+
+void requestFrame(void) { eventLoop.frameRequested = 1; }
+
+static void handleFrameTimer(void *data);
+
+// Draws the requested frame, unless the last one was too recent, in which case
+// a timer comes back for it. Keys that arrive meanwhile all end up in the same
+// frame. A terminal slow to take a frame holds up the clock for the next one
+// too, since writing to it blocks.
+static void flushFrame(void) {
+  if (!eventLoop.frameRequested || eventLoop.frameTimer != -1 ||
+      eventLoop.modal > 0 || eventLoop.view.onFrame == NULL) {
+    return;
+  }
+  long long now = monotonicMs();
+  if (now < eventLoop.nextFrame) {
+    eventLoop.frameTimer =
+        addTimer(eventLoop.nextFrame - now, handleFrameTimer, NULL);
+    return;
+  }
+  eventLoop.frameRequested = 0;
+  eventLoop.view.onFrame(eventLoop.view.data);
+  eventLoop.nextFrame = monotonicMs() + FRAME_MS;
+}
+
+static void handleFrameTimer(void *data) {
+  eventLoop.frameTimer = -1;
+  flushFrame();
+}
+
+void runEventLoop(void) {
+  eventLoop.stopped = 0;
+  while (!eventLoop.stopped) {
+    if (eventLoop.pendingResize) {
+      eventLoop.pendingResize = 0;
+      struct winsize size;
+      if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0) {
+        resizeterm(size.ws_row, size.ws_col);
+      }
+      if (eventLoop.view.onResize != NULL) {
+        eventLoop.view.onResize(eventLoop.view.data);
+      }
+      continue;
+    }
+    flushFrame();
+    dispatchEvents();
+  }
+
+  // This might be nested in another view's handler, whose loop keeps going
+  eventLoop.stopped = 0;
+}
+
+void stopEventLoop(void) { eventLoop.stopped = 1; }
+
+int waitForKey(WINDOW *window) {
+  // Without a loop, there's nothing else to do while waiting anyway
+  if (eventLoop.epoll <= 0) {
+    nodelay(window, FALSE);
+    return wgetch(window);
+  }
+
+  eventLoop.modal++;
+  nodelay(window, TRUE);
+  int key;
+  while ((key = wgetch(window)) == ERR) {
+    dispatchEvents();
+  }
+  eventLoop.modal--;
+  return key;
+}
+
+int startRequest(CURL *curl, struct pendingRequest *request) {
+  if (curl == NULL || request->class >= REQUEST_CLASSES) {
+    return 0;
+  }
+  request->curl = curl;
+  request->preempted = 0;
+  request->attempts = 0;
+  request->retryTimer = -1;
+  queueRequest(request, 0);
+  dispatchRequests();
+  return 1;
+}
+
+enum apiBucket apiBucketFor(const char *url) {
+  return strncmp(url, BASE_SYNC_URL, strlen(BASE_SYNC_URL)) == 0
+             ? BUCKET_SYNC
+             : BUCKET_REST;
+}
+
+void cancelRequest(struct pendingRequest *request) {
+  if (request->state == REQUEST_QUEUED || request->state == REQUEST_RETRYING ||
+      request->state == REQUEST_ATTACHED) {
+    if (request->state == REQUEST_QUEUED) {
+      unlinkRequest(&eventLoop.queued[request->class],
+                    &eventLoop.queuedLast[request->class], request);
+    } else if (request->state == REQUEST_RETRYING) {
+      cancelTimer(request->retryTimer);
     }
+    request->state = REQUEST_IDLE;
+    request->handler(request->curl, CURLE_ABORTED_BY_CALLBACK, request->data);
+  } else if (request->state == REQUEST_RUNNING) {
+    // Cancelling wins over going back in the queue
+    request->preempted = 0;
+    atomic_store(&request->cancelled, 1);
+    curl_multi_wakeup(eventLoop.multi);
   }
+}
 
-  del_panel(projectPanel);
-  unpost_menu(tasksMenu);
-  update_panels();
-  refresh();
+static void finishBlockingRequest(CURL *curl, CURLcode result, void *data) {
+  struct blockingRequest *request = (struct blockingRequest *)data;
+  request->result = result;
+  request->pending = 0;
+}
 
-  // Free variables and whatnot
-  ITEM **taskItems = menu_items(tasksMenu);
-  free(tasksUrl);
-  free(tasksJson);
-  for (int i = 0; i < tasksLength; i++) {
-    free_item(taskItems[i]);
-    struct taskMetaData *toFreeTMD =
-        (struct taskMetaData *)item_userptr(taskItems[i]);
-    free(toFreeTMD);
+CURLcode performRequest(CURL *curl) {
+  if (eventLoop.multi == NULL) {
+    return curl_easy_perform(curl);
   }
-  free_menu(tasksMenu);
-}
 
-ITEM **createTask(struct curlArgs curlArgs, cJSON *tasksJson) {
-  char *newTaskName = displayInputField("Enter the name of a new task.");
-  if (newTaskName == NULL) {
-    displayMessage("There was an error saving the ncurses field.");
-    return NULL;
-  } else {
-    // Create headers
-    struct curl_slist *createTaskHeaders = NULL;
-    createTaskHeaders =
-        curl_slist_append(createTaskHeaders, curlArgs.headers->data);
+  struct blockingRequest blocking = {.pending = 1, .result = CURLE_OK};
+  struct pendingRequest request = {.handler = finishBlockingRequest,
+                                   .data = &blocking,
+                                   .class = REQUEST_INTERACTIVE};
+  if (!startRequest(curl, &request)) {
+    return CURLE_FAILED_INIT;
+  }
+  waitForPending(&blocking.pending);
+  return blocking.result;
+}
 
-    // Create Json
-    cJSON *createTaskPostFieldsJson = cJSON_CreateArray();
-    cJSON *newTask = cJSON_CreateObject();
+void waitForPending(int *pending) {
+  eventLoop.modal++;
+  muteKeys(1);
+  while (*pending > 0) {
+    dispatchEvents();
+  }
+  muteKeys(0);
+  eventLoop.modal--;
+}
 
-    if (!cJSON_AddItemToArray(createTaskPostFieldsJson, newTask)) {
-      displayMessage("There was an error creating the JSON. Press any key "
-                     "to return to the main menu.");
-      return NULL;
+// Hands over keys put back by waitForPendingOrBack, which the tty being
+// readable won't do
+static void replayKeys(void *data) { handleTty(STDIN_FILENO, EPOLLIN, NULL); }
+
+int waitForPendingOrBack(int *pending, struct pendingRequest *request) {
+  int keys[32];
+  int keysLength = 0;
+  int backedOut = 0;
+  eventLoop.modal++;
+  while (*pending > 0) {
+    int key = wgetch(eventLoop.input);
+    if (key == ERR) {
+      dispatchEvents();
+    } else if ((key == 'h' || key == 27) && !backedOut) {
+      backedOut = 1;
+      cancelRequest(request);
+    } else if (keysLength < 32) {
+      keys[keysLength++] = key;
     }
+  }
+  eventLoop.modal--;
 
-    if (!cJSON_AddStringToObject(newTask, "type", "item_add")) {
-      displayMessage("There was an error creating the JSON. Press any key "
-                     "to return to the main menu.");
-      return NULL;
-    }
+  // ungetch puts keys in front of what's already there
+  for (int i = keysLength - 1; i >= 0; i--) {
+    ungetch(keys[i]);
+  }
+  if (keysLength > 0) {
+    addTimer(0, replayKeys, NULL);
+  }
+  return !backedOut;
+}
 
-    // Create and add uuid
-    uuid_t tmp_binuuid;
-    uuid_generate_random(tmp_binuuid);
-    char *tmp_uuid = malloc(37);
-    uuid_unparse(tmp_binuuid, tmp_uuid);
-    if (!cJSON_AddStringToObject(newTask, "temp_id", tmp_uuid)) {
-      displayMessage("There was an error creating the JSON. Press any key "
-                     "to return to the main menu.");
-      return NULL;
+// The index of the worker running on this thread, or -1 on the UI thread
+static __thread int workerIndex = -1;
+
+// Takes a job from the back (newest) or the front (oldest) of deque. Returns
+// NULL if it's empty.
+static struct job *takeJob(struct jobDeque *deque, int back) {
+  struct job *job = NULL;
+  pthread_mutex_lock(&deque->lock);
+  if (deque->length > 0) {
+    deque->length--;
+    if (back) {
+      job = deque->jobs[(deque->head + deque->length) % deque->capacity];
+    } else {
+      job = deque->jobs[deque->head];
+      deque->head = (deque->head + 1) % deque->capacity;
     }
+  }
+  pthread_mutex_unlock(&deque->lock);
+  return job;
+}
 
-    uuid_t binuuid;
-    uuid_generate_random(binuuid);
-    char *uuid = malloc(37);
-    uuid_unparse(binuuid, uuid);
-    if (!cJSON_AddStringToObject(newTask, "uuid", uuid)) {
-      displayMessage("There was an error creating the JSON. Press any key "
-                     "to return to the main menu.");
-      return NULL;
+// Takes the oldest queued job owned by owner out of whichever deque it's in,
+// or returns NULL if none is left. Called with the pool's lock held, and
+// queued still counting it.
+static struct job *takeOwnedJob(atomic_int *owner) {
+  for (int i = 0; i < workerPool.length; i++) {
+    struct jobDeque *deque = &workerPool.deques[i];
+    pthread_mutex_lock(&deque->lock);
+    for (int j = 0; j < deque->length; j++) {
+      struct job *job = deque->jobs[(deque->head + j) % deque->capacity];
+      if (job->owner != owner) {
+        continue;
+      }
+      // Closes the gap by moving the ones behind it up
+      for (int k = j + 1; k < deque->length; k++) {
+        deque->jobs[(deque->head + k - 1) % deque->capacity] =
+            deque->jobs[(deque->head + k) % deque->capacity];
+      }
+      deque->length--;
+      pthread_mutex_unlock(&deque->lock);
+      return job;
     }
+    pthread_mutex_unlock(&deque->lock);
+  }
+  return NULL;
+}
 
-    cJSON *args = cJSON_CreateObject();
-    if (!cJSON_AddItemToObject(newTask, "args", args)) {
-      displayMessage("There was an error creating the JSON. Press any key "
-                     "to return to the main menu.");
-      return NULL;
+static int pushJob(struct jobDeque *deque, struct job *job) {
+  pthread_mutex_lock(&deque->lock);
+  if (deque->length == deque->capacity) {
+    int capacity = deque->capacity ? deque->capacity * 2 : 16;
+    struct job **jobs = malloc(capacity * sizeof(struct job *));
+    if (jobs == NULL) {
+      pthread_mutex_unlock(&deque->lock);
+      return 0;
     }
-
-    if (!cJSON_AddStringToObject(args, "content", newTaskName)) {
-      displayMessage("There was an error creating the JSON. Press any key "
-                     "to return to the main menu.");
-      return NULL;
+    // Unwrapped into the new ring, so head starts over at 0
+    for (int i = 0; i < deque->length; i++) {
+      jobs[i] = deque->jobs[(deque->head + i) % deque->capacity];
     }
+    free(deque->jobs);
+    deque->jobs = jobs;
+    deque->capacity = capacity;
+    deque->head = 0;
+  }
+  deque->jobs[(deque->head + deque->length) % deque->capacity] = job;
+  deque->length++;
+  pthread_mutex_unlock(&deque->lock);
+  return 1;
+}
 
-    char *commands = combineString(
-        "commands=", cJSON_PrintUnformatted(createTaskPostFieldsJson));
+// Gets job->finish called on the UI thread, right away if this is it
+static void finishJob(struct job *job) {
+  if (workerIndex == -1) {
+    job->finish(job->data);
+    return;
+  }
+  pthread_mutex_lock(&workerPool.finishedLock);
+  job->next = workerPool.finished;
+  workerPool.finished = job;
+  pthread_mutex_unlock(&workerPool.finishedLock);
+  signalEventFd(workerPool.finishedFd);
+}
+
+static void runJob(struct job *job) {
+  // Without finish, run can let whoever's waiting know it's done, and they
+  // can free the job, so it isn't touched again
+  void (*finish)(void *data) = job->finish;
+  atomic_int *owner = job->owner;
+  job->run(job->data);
+  if (finish != NULL) {
+    finishJob(job);
+  }
+  // Its owner's counter went down in run, and whoever's waiting on it checks
+  // that under the lock, so it can't miss this
+  if (owner != NULL) {
+    pthread_mutex_lock(&workerPool.lock);
+    pthread_cond_broadcast(&workerPool.done);
+    pthread_mutex_unlock(&workerPool.lock);
+  }
+}
 
-    struct curlArgs createTaskCurlArgs = {curlArgs.curl, createTaskHeaders,
-                                          "POST", BASE_SYNC_URL, commands};
+static void *runWorker(void *data) {
+  workerIndex = (int)(intptr_t)data;
+  struct jobDeque *own = &workerPool.deques[workerIndex];
 
-    // Request
-    cJSON *result = makeRequest(createTaskCurlArgs);
-    free(commands);
-    if (result == NULL) {
-      displayMessage(
-          "Something went wrong when making the request to close the "
-          "task. Press any key to return to the projects menu.");
+  while (1) {
+    // Claiming one of the queued jobs first means there's sure to be one in
+    // some deque, even if it takes a few tries to find
+    pthread_mutex_lock(&workerPool.lock);
+    while (workerPool.queued == 0 && !workerPool.stopping) {
+      pthread_cond_wait(&workerPool.wake, &workerPool.lock);
+    }
+    if (workerPool.queued == 0) {
+      pthread_mutex_unlock(&workerPool.lock);
       return NULL;
     }
-    // tmp_uuid will be free later on
-    free(uuid);
-
-    int curItemsLength = cJSON_GetArraySize(tasksJson);
-
-    // Make space for new item (hence + 2)
-    ITEM **newItems =
-        createItemsFromJson(tasksJson, curItemsLength + 2, "content");
-
-    newItems[curItemsLength] = new_item(newTaskName, "1");
-
-    struct taskMetaData *newTaskMetaData =
-        (struct taskMetaData *)malloc(sizeof(struct taskMetaData));
-    newTaskMetaData->content = newTaskName;
-
-    // Get and set new task's id from response
-    cJSON *tmpIdMapping =
-        cJSON_GetObjectItemCaseSensitive(result, "temp_id_mapping");
+    workerPool.queued--;
+    pthread_mutex_unlock(&workerPool.lock);
 
-    if (!tmpIdMapping) {
-      displayMessage("Something went wrong when accessing the id of the new "
-                     "task. Press any key to return to the projects menu.");
-      return NULL;
+    struct job *job = takeJob(own, 1);
+    for (int i = 1; job == NULL; i++) {
+      job = takeJob(&workerPool.deques[(workerIndex + i) % workerPool.length],
+                    0);
     }
 
-    cJSON *idJson = cJSON_GetObjectItemCaseSensitive(tmpIdMapping, tmp_uuid);
+    runJob(job);
+  }
+}
 
-    if (!idJson) {
-      displayMessage("Something went wrong when accessing the id of the new "
-                     "task. Press any key to return to the projects menu.");
-      return NULL;
+void helpJobs(atomic_int *pending) {
+  pthread_mutex_lock(&workerPool.lock);
+  while (atomic_load(pending) > 0) {
+    // With nothing queued, a worker's claimed whatever of pending's is left
+    // in the deques, and will run it
+    struct job *job = workerPool.queued > 0 ? takeOwnedJob(pending) : NULL;
+    if (job == NULL) {
+      pthread_cond_wait(&workerPool.done, &workerPool.lock);
+      continue;
     }
+    workerPool.queued--;
+    pthread_mutex_unlock(&workerPool.lock);
+    runJob(job);
+    pthread_mutex_lock(&workerPool.lock);
+  }
+  pthread_mutex_unlock(&workerPool.lock);
+}
 
-    free(tmp_uuid);
-    char *id = idJson->valuestring;
-
-    newTaskMetaData->id = id;
-    newTaskMetaData->priority = 1;
-    set_item_userptr(newItems[curItemsLength], newTaskMetaData);
+// Calls finish for the jobs the workers are done with, in the order they
+// finished
+static void handleFinishedJobs(int fd, unsigned int events, void *data) {
+  clearEventFd(fd);
+
+  pthread_mutex_lock(&workerPool.finishedLock);
+  struct job *finished = workerPool.finished;
+  workerPool.finished = NULL;
+  pthread_mutex_unlock(&workerPool.finishedLock);
+
+  struct job *ordered = NULL;
+  while (finished != NULL) {
+    struct job *next = finished->next;
+    finished->next = ordered;
+    ordered = finished;
+    finished = next;
+  }
+  while (ordered != NULL) {
+    struct job *next = ordered->next;
+    ordered->finish(ordered->data);
+    ordered = next;
+  }
+}
 
-    newItems[curItemsLength + 1] = (ITEM *)NULL;
+int initWorkerPool(void) {
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  int length = cores < 1 ? 1 : cores > MAX_WORKERS ? MAX_WORKERS : (int)cores;
+
+  workerPool.finishedFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  workerPool.threads = calloc(length, sizeof(pthread_t));
+  workerPool.deques = calloc(length, sizeof(struct jobDeque));
+  if (workerPool.finishedFd == -1 || workerPool.threads == NULL ||
+      workerPool.deques == NULL ||
+      !watchFd(workerPool.finishedFd, EPOLLIN, handleFinishedJobs, NULL)) {
+    freeWorkerPool();
+    return 0;
+  }
+  pthread_mutex_init(&workerPool.lock, NULL);
+  pthread_cond_init(&workerPool.wake, NULL);
+  pthread_cond_init(&workerPool.done, NULL);
+  pthread_mutex_init(&workerPool.finishedLock, NULL);
+  for (int i = 0; i < length; i++) {
+    pthread_mutex_init(&workerPool.deques[i].lock, NULL);
+  }
 
-    return newItems;
+  // length only goes up as threads start, so a failure part way still leaves
+  // a pool, just a smaller one
+  for (int i = 0; i < length; i++) {
+    if (pthread_create(&workerPool.threads[i], NULL, runWorker,
+                       (void *)(intptr_t)i) != 0) {
+      break;
+    }
+    workerPool.length++;
   }
+  return workerPool.length > 0;
 }
 
-ITEM **createItemsFromJson(cJSON *json, int customLength, char *query) {
-  ITEM **newItems = (ITEM **)malloc(customLength * sizeof(struct ITEM *));
-  int itemsLength = cJSON_GetArraySize(json);
-
-  for (int i = 0; i < itemsLength; i++) {
-    cJSON *curItem = cJSON_GetArrayItem(json, i);
-    if (curItem == NULL) {
-      return NULL;
+void freeWorkerPool(void) {
+  if (workerPool.length > 0) {
+    pthread_mutex_lock(&workerPool.lock);
+    workerPool.stopping = 1;
+    pthread_cond_broadcast(&workerPool.wake);
+    pthread_mutex_unlock(&workerPool.lock);
+    for (int i = 0; i < workerPool.length; i++) {
+      pthread_join(workerPool.threads[i], NULL);
     }
-    cJSON *curContent = cJSON_GetObjectItemCaseSensitive(curItem, query);
-    if (curContent == NULL) {
-      return NULL;
+  }
+  if (workerPool.finishedFd > 0) {
+    unwatchFd(workerPool.finishedFd);
+    close(workerPool.finishedFd);
+  }
+  if (workerPool.deques != NULL) {
+    for (int i = 0; i < workerPool.length; i++) {
+      free(workerPool.deques[i].jobs);
     }
+  }
+  free(workerPool.deques);
+  free(workerPool.threads);
+  memset(&workerPool, 0, sizeof(workerPool));
+}
 
-    // If curPriority is NULL, we're rendering the projects menu
-    cJSON *curPriority = cJSON_GetObjectItemCaseSensitive(curItem, "priority");
+void submitJob(struct job *job) {
+  // Only the UI thread picks deques round robin, so nextDeque doesn't need to
+  // be atomic
+  int index = workerIndex != -1 ? workerIndex
+              : workerPool.length > 0
+                  ? (int)(workerPool.nextDeque++ %
+                          (unsigned int)workerPool.length)
+                  : -1;
+
+  // Without workers (or room for the job), there's no one else to do it
+  if (index == -1 || !pushJob(&workerPool.deques[index], job)) {
+    runJob(job);
+    return;
+  }
+  pthread_mutex_lock(&workerPool.lock);
+  workerPool.queued++;
+  pthread_cond_signal(&workerPool.wake);
+  pthread_mutex_unlock(&workerPool.lock);
+}
 
-    if (curPriority == NULL) {
-      newItems[i] = new_item(curContent->valuestring, NULL);
-    } else {
-      cJSON *curId = cJSON_GetObjectItemCaseSensitive(curItem, "id");
-      if (!curId) {
-        return NULL;
-      }
+static void parseChunk(void *data) {
+  struct parseChunk *chunk = (struct parseChunk *)data;
+  chunk->json = cJSON_ParseWithOpts(chunk->text, NULL, 0);
+  free(chunk->text);
+  chunk->text = NULL;
+  atomic_fetch_sub(chunk->pending, 1);
+}
 
-      if (!cJSON_IsString(curId)) {
-        return NULL;
+// Finds where to split the array starting at text[0] (a '[') into chunks,
+// filling splits with the offsets of top-level commas, the first after every
+// multiple of chunkBytes. Returns how many, or -1 if the array doesn't close
+// where length says it does.
+static int splitJsonArray(const char *text, size_t length, size_t chunkBytes,
+                          size_t *splits, int splitsCapacity) {
+  int splitsLength = 0;
+  int depth = 0;
+  size_t nextSplit = chunkBytes;
+  for (size_t i = 0; i < length; i++) {
+    switch (text[i]) {
+    case '"':
+      // Strings can hold any of these, so skip to the first quote that isn't
+      // escaped (by an odd number of backslashes). memchr gets there a lot
+      // faster than looking at each byte here.
+      while (1) {
+        const char *quote = memchr(text + i + 1, '"', length - i - 1);
+        if (quote == NULL) {
+          return -1;
+        }
+        i = quote - text;
+        size_t backslashes = 0;
+        while (text[i - 1 - backslashes] == '\\') {
+          backslashes++;
+        }
+        if (backslashes % 2 == 0) {
+          break;
+        }
+      }
+      break;
+    case '[':
+    case '{':
+      depth++;
+      break;
+    case ']':
+    case '}':
+      if (--depth == 0) {
+        // Anything after the array other than whitespace isn't JSON
+        return i + 1 + strspn(text + i + 1, " \t\r\n") == length ? splitsLength
+                                                                 : -1;
+      }
+      break;
+    case ',':
+      if (depth == 1 && i >= nextSplit && splitsLength < splitsCapacity) {
+        splits[splitsLength++] = i;
+        nextSplit = i + chunkBytes;
       }
+      break;
+    }
+  }
+  return -1;
+}
 
-      // No idea why we need to do this for the priority field...
-      newItems[i] = new_item(curContent->valuestring, cJSON_Print(curPriority));
+cJSON *parseJson(const char *text, size_t length, const char **error) {
+  // cJSON_Parse's errors can only be found through a global the workers would
+  // overwrite each other's in, so everything goes through cJSON_ParseWithOpts,
+  // which hands back its own
+  size_t start = strspn(text, " \t\r\n");
+  int chunksCapacity = workerPool.length * PARSE_CHUNKS_PER_WORKER;
+  if (length < PARALLEL_PARSE_BYTES || text[start] != '[' ||
+      workerPool.length < 2) {
+    return cJSON_ParseWithOpts(text, error, 0);
+  }
+  size_t chunkBytes = (length - start) / chunksCapacity;
+  if (chunkBytes < PARSE_CHUNK_BYTES) {
+    chunkBytes = PARSE_CHUNK_BYTES;
+  }
 
-      // Add metadata to userptr (DON'T FORGET TO FREE() THIS)
-      struct taskMetaData *newTaskMetaData =
-          (struct taskMetaData *)malloc(sizeof(struct taskMetaData *));
-      newTaskMetaData->content = curContent->string;
-      newTaskMetaData->priority = curPriority->valueint;
-      newTaskMetaData->id = curId->valuestring;
-      set_item_userptr(newItems[i], newTaskMetaData);
+  size_t splits[MAX_WORKERS * PARSE_CHUNKS_PER_WORKER];
+  int splitsLength = splitJsonArray(text + start, length - start, chunkBytes,
+                                    splits, chunksCapacity - 1);
+  struct parseChunk *chunks =
+      splitsLength > 0 ? calloc(splitsLength + 1, sizeof(struct parseChunk))
+                       : NULL;
+  if (chunks == NULL) {
+    return cJSON_ParseWithOpts(text, error, 0);
+  }
+
+  // Each chunk is the elements between two splits (leaving out the commas),
+  // wrapped in brackets so it's an array of its own. The last one already has
+  // the array's closing bracket.
+  atomic_int pending = splitsLength + 1;
+  size_t from = start + 1;
+  for (int i = 0; i <= splitsLength; i++) {
+    size_t to = i < splitsLength ? start + splits[i] : length;
+    struct parseChunk *chunk = &chunks[i];
+    chunk->job =
+        (struct job){.run = parseChunk, .data = chunk, .owner = &pending};
+    chunk->pending = &pending;
+    chunk->text = malloc(to - from + 3);
+    if (chunk->text == NULL) {
+      atomic_fetch_sub(&pending, 1);
+    } else {
+      chunk->text[0] = '[';
+      memcpy(chunk->text + 1, text + from, to - from);
+      strcpy(chunk->text + 1 + (to - from), i < splitsLength ? "]" : "");
+      submitJob(&chunk->job);
+    }
+    from = to + 1;
+  }
+  helpJobs(&pending);
+
+  // Every chunk has at least one element, or the array had an empty one
+  // (like "[1,,2]") that a chunk boundary happened to hide
+  int parsed = 1;
+  for (int i = 0; i <= splitsLength; i++) {
+    if (chunks[i].json == NULL || chunks[i].json->child == NULL) {
+      parsed = 0;
     }
   }
+  cJSON *json = parsed ? chunks[0].json : NULL;
+  for (int i = 0; i <= splitsLength; i++) {
+    cJSON *part = chunks[i].json;
+    if (!parsed) {
+      cJSON_Delete(part);
+      continue;
+    } else if (i == 0) {
+      continue;
+    }
 
-  return newItems;
+    // Splicing the lists together is O(1) a chunk. cJSON keeps the last
+    // element in the first one's prev.
+    cJSON *last = json->child->prev;
+    cJSON *partLast = part->child->prev;
+    last->next = part->child;
+    part->child->prev = last;
+    json->child->prev = partLast;
+    part->child = NULL;
+    cJSON_Delete(part);
+  }
+  free(chunks);
+
+  // The whole thing again gets the error where cJSON would put it
+  return json != NULL ? json : cJSON_ParseWithOpts(text, error, 0);
 }
 
-void setItemsAndRepostMenu(MENU *menu, ITEM **items) {
-  unpost_menu(menu);
+// Arms the timer for the next refresh, interval from now, give or take the
+// jitter so clients started together don't stay in step
+static void scheduleRefresh(long long interval);
 
-  // Free old menu items
-  ITEM **oldItems = menu_items(menu);
-  int i = 0;
-  while (oldItems[i] != NULL) {
-    free(oldItems[i]);
-    i++;
+static void startRefresh(void *data);
+
+static void scheduleRefresh(long long interval) {
+  if (refresher.timer != -1) {
+    cancelTimer(refresher.timer);
   }
-  free(oldItems[i]);
+  long long jitter = interval * REFRESH_JITTER / 100;
+  long long delay =
+      interval - jitter +
+      (long long)(rand_r(&refresher.seed) % (unsigned int)(2 * jitter + 1));
+  refresher.timer = addTimer(delay, startRefresh, NULL);
+  refresher.due = monotonicMs() + delay;
+}
 
-  // Hopefully this doesn't shoot me in the foot later on
-  int row, col;
-  getmaxyx(stdscr, row, col);
-  set_menu_items(menu, items);
-  set_menu_format(menu, row, 1);
-  post_menu(menu);
+// The view can only be swapped out from under the user when nothing points
+// into its tasks and it's showing all of them
+static int canRefreshView(struct taskView *view) {
+  return view->pendingMutations == 0 && view->asking == NULL &&
+         view->searching == NULL &&
+         !view->tree->filtered && eventLoop.modal == 0;
 }
 
-char *getJsonValue(cJSON *json, char *key) {
-  cJSON *keyValuePair = cJSON_GetObjectItemCaseSensitive(json, key);
-  if (keyValuePair == NULL) {
-    displayMessage("Something went wrong when closing the task. Press any "
-                   "key to return to the projects menu. (getJsonValue 1)");
-    return NULL;
+// Builds view's tasks again from the cache, sorted, keeping the cursor on the
+// same task
+static void refreshTaskView(struct taskView *view, const char *viewKey) {
+  cJSON *tasks = NULL;
+  size_t prefixLength = strlen(FILTER_VIEW_ID_PREFIX);
+  if (strncmp(viewKey, FILTER_VIEW_ID_PREFIX, prefixLength) == 0) {
+    tasks = cJSON_Duplicate(
+        getFilterResults(
+            &refresher.projects->filterViews[atoi(viewKey + prefixLength)]),
+        true);
+  } else {
+    tasks = cJSON_CreateArray();
+    for (int i = 0; tasks != NULL && i < taskCache.length; i++) {
+      cJSON *task = taskCache.tasks[i]->json;
+      char *projectId = cJSON_GetStringValue(
+          cJSON_GetObjectItemCaseSensitive(task, "project_id"));
+      if (projectId != NULL && strcmp(projectId, viewKey) == 0) {
+        cJSON_AddItemToArray(tasks, cJSON_Duplicate(task, true));
+      }
+    }
   }
-  char *value = keyValuePair->valuestring;
-  if (value == NULL) {
-    displayMessage("Something went wrong when closing the task. Press any "
-                   "key to return to the projects menu. (getJsonValue 2)");
-    return NULL;
+  cJSON *sorted = tasks != NULL ? prepareTasks(tasks) : NULL;
+  if (sorted == NULL) {
+    view->stale = 1;
+    return;
   }
 
-  return value;
+  // The old tree still points into the old tasks until it's reloaded
+  cJSON *old = view->json;
+  view->json = sorted;
+  reloadTaskRows(view);
+  cJSON_Delete(old);
+  view->stale = 0;
+  requestFrame();
 }
 
-int getJsonIntValue(cJSON *json, char *key) {
-  cJSON *keyValuePair = cJSON_GetObjectItemCaseSensitive(json, key);
-  if (keyValuePair == NULL) {
-    displayMessage("Something went wrong when closing the task. Press any "
-                   "key to return to the projects menu. (getJsonIntValue 1)");
-    return -1;
+// Puts changed Sync API items into the cache. A full sync also takes out
+// whatever it didn't mention. Returns whether anything changed.
+static int applyItemChanges(cJSON *items, int fullSync) {
+  int changed = 0;
+  struct stringMap seen = {0};
+  if (fullSync && !stringMapInit(&seen, cJSON_GetArraySize(items))) {
+    fullSync = 0;
   }
-  return keyValuePair->valueint;
-}
 
-cJSON *createJsonDueCommand(char *string, char *itemId) {
-  cJSON *postFieldsJson = cJSON_CreateObject();
-  cJSON *commands = cJSON_CreateArray();
-  cJSON *command = cJSON_CreateObject();
-  if (postFieldsJson == NULL || commands == NULL || command == NULL) {
-    displayMessage(
-        "Something went wrong when creating JSON for request (2). Press "
-        "any key to return to the projects menu.");
-    return false;
+  cacheBeginChanges();
+  cJSON *item = NULL;
+  cJSON_ArrayForEach(item, items) {
+    char *id =
+        cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(item, "id"));
+    if (id == NULL) {
+      continue;
+    }
+    if (fullSync) {
+      stringMapPut(&seen, id, 1);
+    }
+    // Sync items have the same fields the cache looks at as REST tasks, so
+    // they go in as they are
+    if (cJSON_IsTrue(cJSON_GetObjectItemCaseSensitive(item, "checked")) ||
+        cJSON_IsTrue(cJSON_GetObjectItemCaseSensitive(item, "is_deleted"))) {
+      if (findCachedTask(id) != NULL) {
+        cacheRemoveTask(id);
+        changed = 1;
+      }
+    } else if (cacheUpdateTask(cJSON_Duplicate(item, true))) {
+      changed = 1;
+    }
   }
-  cJSON_AddItemToObject(postFieldsJson, "commands", commands);
-  cJSON_AddItemToArray(commands, command);
-
-  // Type, uuid, and args
-  // uuid specifically
-  uuid_t binuuid;
-  uuid_generate_random(binuuid);
-  char *uuid = malloc(37);
-  uuid_unparse(binuuid, uuid);
 
-  cJSON *args = cJSON_CreateObject();
-  if (cJSON_AddStringToObject(command, "type", "item_update") == NULL) {
-    displayMessage(
-        "Something went wrong when creating JSON for request (3). Press "
-        "any key to return to the projects menu.");
-    return false;
-  }
-  if (cJSON_AddStringToObject(command, "uuid", uuid) == NULL) {
-    displayMessage(
-        "Something went wrong when creating JSON for request (4). Press "
-        "any key to return to the projects menu.");
-    return false;
-  }
-  // Why false and not NULL? No idea.
-  if (cJSON_AddItemToObject(command, "args", args) == false) {
-    displayMessage(
-        "Something went wrong when creating JSON for request (5). Press "
-        "any key to return to the projects menu.");
-    return false;
-  }
-
-  // Id and due fields on args
-  cJSON *due = cJSON_CreateObject();
-  if (cJSON_AddStringToObject(args, "id", itemId) == NULL) {
-    displayMessage(
-        "Something went wrong when creating JSON for request (6). Press "
-        "any key to return to the projects menu.");
-    return false;
-  }
-  // This is where we actually set the due date to today, thus "reopening" the
-  // task
-  if (cJSON_AddStringToObject(due, "string", string) == NULL) {
-    displayMessage(
-        "Something went wrong when creating JSON for request (7). Press "
-        "any key to return to the projects menu.");
-    return false;
-  }
-  if (cJSON_AddItemToObject(args, "due", due) == false) {
-    displayMessage(
-        "Something went wrong when creating JSON for request (9). Press "
-        "any key to return to the projects menu.");
-    return false;
+  if (fullSync) {
+    // Removing swaps the last task into the hole, so go from the end
+    for (int i = taskCache.length - 1; i >= 0; i--) {
+      char *id = cJSON_GetStringValue(
+          cJSON_GetObjectItemCaseSensitive(taskCache.tasks[i]->json, "id"));
+      if (stringMapGet(&seen, id) == -1) {
+        cacheRemoveTask(id);
+        changed = 1;
+      }
+    }
+    stringMapFree(&seen);
   }
-
-  return postFieldsJson;
+  cacheEndChanges();
+  return changed;
 }
 
-boolean reopenTask(cJSON *tasksJson, MENU *tasksMenu,
-                   struct curlArgs curlArgs) {
-  // Get information about the currently selected item
-  ITEM *currentItem = current_item(tasksMenu);
-  cJSON *currentItemJson = getCurrentItemJson(tasksMenu, tasksJson);
-  char *currentItemId = getJsonValue(currentItemJson, "id");
-  if (currentItemId == NULL) {
-    displayMessage("Something went wrong when closing the task. Press any key "
-                   "to return to the projects menu. (reopenTask 1)");
-    return false;
+// Finds the projects menu entry for id. Returns its index, or -1, and sets
+// firstFilter to where the filter views start (or -1 if there are none).
+static int findProjectEntry(cJSON *json, const char *id, int *firstFilter) {
+  int found = -1;
+  int index = 0;
+  *firstFilter = -1;
+  cJSON *entry = NULL;
+  cJSON_ArrayForEach(entry, json) {
+    char *entryId = getJsonValue(entry, "id");
+    if (strcmp(entryId, id) == 0) {
+      found = index;
+    } else if (*firstFilter == -1 &&
+               strncmp(entryId, FILTER_VIEW_ID_PREFIX,
+                       strlen(FILTER_VIEW_ID_PREFIX)) == 0) {
+      *firstFilter = index;
+    }
+    index++;
   }
-  char *reopenTaskUrl = BASE_SYNC_URL;
-
-  // Gathering data for postFields (cJSON * -> char *)
-  cJSON *postFieldsJson =
-      createJsonDueCommand("every day starting today", currentItemId);
+  return found;
+}
 
-  if (postFieldsJson == NULL) {
-    return false;
-  }
+// Puts changed projects into the projects menu, replacing just the items that
+// changed. Filter views stay at the end. Projects the refresh mentions without
+// any change to their name leave the menu alone.
+static void applyProjectChanges(cJSON *projects) {
+  struct projectsView *projectsView = refresher.projects;
+  MENU *menu = projectsView->menu;
+  int length = item_count(menu);
+  ITEM **oldItems = menu_items(menu);
+  ITEM *current = current_item(menu);
+  int currentIndex = item_index(current);
+
+  // Every project could be new, and items are only freed once the menu has
+  // let go of them
+  int projectsLength = cJSON_GetArraySize(projects);
+  ITEM **items = NULL;
+  ITEM **retired = NULL;
+  int retiredLength = 0;
+
+  cJSON *project = NULL;
+  cJSON_ArrayForEach(project, projects) {
+    char *id =
+        cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(project, "id"));
+    char *name =
+        cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(project, "name"));
+    if (id == NULL || name == NULL) {
+      continue;
+    }
+    int gone =
+        cJSON_IsTrue(cJSON_GetObjectItemCaseSensitive(project, "is_deleted")) ||
+        cJSON_IsTrue(cJSON_GetObjectItemCaseSensitive(project, "is_archived"));
+    int firstFilter;
+    int index = findProjectEntry(projectsView->json, id, &firstFilter);
+    cJSON *existing =
+        index == -1 ? NULL : cJSON_GetArrayItem(projectsView->json, index);
+    char *existingName =
+        existing == NULL ? NULL : getJsonValue(existing, "name");
+    if ((gone && existing == NULL) ||
+        (!gone && existingName != NULL && strcmp(existingName, name) == 0)) {
+      continue;
+    }
 
-  char *postFields = cJSON_PrintUnformatted(postFieldsJson);
+    // The first change takes the menu down, since its items point at the
+    // names in the JSON
+    if (items == NULL) {
+      items = malloc((length + projectsLength + 1) * sizeof(ITEM *));
+      retired = malloc((projectsLength + 1) * sizeof(ITEM *));
+      if (items == NULL || retired == NULL) {
+        free(items);
+        free(retired);
+        return;
+      }
+      memcpy(items, oldItems, (length + 1) * sizeof(ITEM *));
+      unpost_menu(menu);
+    }
 
-  // Making the request
-  struct curl_slist *reopenHeaders = NULL;
-  reopenHeaders = curl_slist_append(reopenHeaders, curlArgs.headers->data);
-  reopenHeaders =
-      curl_slist_append(reopenHeaders, "Content-Type: application/json");
-  reopenHeaders = curl_slist_append(reopenHeaders, "Accept: application/json");
-  struct curlArgs reopenTaskArgs = {curlArgs.curl, reopenHeaders, "POST",
-                                    reopenTaskUrl, postFields};
-  cJSON *result = makeRequest(reopenTaskArgs);
+    if (existing != NULL) {
+      retired[retiredLength++] = items[index];
+      ITEM *renamed = NULL;
+      if (!gone) {
+        cJSON *nameJson = cJSON_GetObjectItemCaseSensitive(existing, "name");
+        cJSON_SetValuestring(nameJson, name);
+        renamed = new_item(cJSON_GetStringValue(nameJson), NULL);
+      }
+      if (renamed != NULL) {
+        items[index] = renamed;
+        continue;
+      }
+      // Gone, or renamed without room for its new item, in which case it's
+      // dropped so the menu and the JSON still line up
+      memmove(items + index, items + index + 1,
+              (length - index) * sizeof(ITEM *));
+      length--;
+      cJSON_Delete(cJSON_DetachItemViaPointer(projectsView->json, existing));
+      continue;
+    }
 
-  if (result == NULL) {
-    displayMessage("Something went wrong when making the request to close the "
-                   "task. Press any key to return to the projects menu.");
-    return false;
+    ITEM *item = NULL;
+    cJSON *newProject = cJSON_CreateObject();
+    if (cJSON_AddStringToObject(newProject, "id", id) == NULL ||
+        cJSON_AddStringToObject(newProject, "name", name) == NULL ||
+        (item = new_item(getJsonValue(newProject, "name"), NULL)) == NULL) {
+      cJSON_Delete(newProject);
+      continue;
+    }
+    index = firstFilter != -1 ? firstFilter : length;
+    cJSON_InsertItemInArray(projectsView->json, index, newProject);
+    memmove(items + index + 1, items + index,
+            (length - index + 1) * sizeof(ITEM *));
+    items[index] = item;
+    length++;
+  }
+  if (items == NULL) {
+    return;
   }
+  projectsView->version++;
 
-  return true;
+  // The selection stays on the same project if it's still there
+  set_menu_items(menu, items);
+  int index = 0;
+  while (index < length && items[index] != current) {
+    index++;
+  }
+  if (index == length) {
+    index = currentIndex < length ? currentIndex : length - 1;
+  }
+  set_menu_format(menu, projectsView->row, 1);
+  set_current_item(menu, items[index]);
+  post_menu(menu);
+  for (int i = 0; i < retiredLength; i++) {
+    free_item(retired[i]);
+  }
+  free(retired);
+  free(oldItems);
+  requestFrame();
 }
 
-ITEM **closeTask(cJSON *tasksJson, MENU *tasksMenu, struct curlArgs curlArgs) {
-  ITEM *currentItem = current_item(tasksMenu);
-
-  // Possibly hacky solution -- if there are no items to complete, just return
-  if (strcmp(item_name(currentItem), NO_TASKS_TO_COMPLETE_MESSAGE) == 0) {
-    return menu_items(tasksMenu);
-  }
+static void finishRefresh(struct jsonRequest *request) {
+  long long interval = refresher.interval;
+  cJSON *json = request->json;
+  free(request->response.response);
+  request->response.response = NULL;
+  request->json = NULL;
+
+  char *syncToken = cJSON_GetStringValue(
+      cJSON_GetObjectItemCaseSensitive(json, "sync_token"));
+  if (request->result == CURLE_OK && request->httpCode == 200 &&
+      syncToken != NULL) {
+    int fullSync =
+        cJSON_IsTrue(cJSON_GetObjectItemCaseSensitive(json, "full_sync"));
+    struct taskView *view = refresher.view;
+    unsigned long viewVersionBefore =
+        view != NULL ? viewVersion(refresher.viewKey) : 0;
+    int changed = applyItemChanges(
+        cJSON_GetObjectItemCaseSensitive(json, "items"), fullSync);
+    applyProjectChanges(cJSON_GetObjectItemCaseSensitive(json, "projects"));
+    free(refresher.syncToken);
+    refresher.syncToken = strdup(syncToken);
+
+    // Only changes to what the open view shows rebuild it. One that couldn't
+    // take changes before gets them now, if it can.
+    if (view != NULL && (viewVersion(refresher.viewKey) != viewVersionBefore ||
+                         view->stale)) {
+      if (canRefreshView(view)) {
+        refreshTaskView(view, refresher.viewKey);
+      } else {
+        view->stale = 1;
+      }
+    }
 
-  cJSON *currentItemJson = getCurrentItemJson(tasksMenu, tasksJson);
-  if (currentItemJson == NULL) {
-    displayMessage("Something went wrong when closing the task. Press any "
-                   "key to return to the projects menu (closeTask 1).");
-    return NULL;
+    // Things changing means they're likely to again soon. Nothing changing
+    // while nobody's around means backing off.
+    if (changed || monotonicMs() - refresher.lastActivity < ACTIVE_MS) {
+      interval = REFRESH_MS;
+    } else {
+      interval = interval * 2 < REFRESH_MAX_MS ? interval * 2 : REFRESH_MAX_MS;
+    }
+  } else {
+    // Failures back off too, so a server that's down isn't hammered
+    interval = interval * 2 < REFRESH_MAX_MS ? interval * 2 : REFRESH_MAX_MS;
   }
+  cJSON_Delete(json);
+  refresher.interval = interval;
+  scheduleRefresh(interval);
+}
 
-  char *currentItemId = getJsonValue(currentItemJson, "id");
-
-  cJSON *postFieldsJson =
-      createJsonDueCommand("every day starting tomorrow", currentItemId);
+static void startRefresh(void *data) {
+  refresher.timer = -1;
 
-  if (postFieldsJson == NULL) {
-    return NULL;
+  // Not while someone's typing into a prompt, or while changes are still
+  // being saved
+  if (eventLoop.modal > 0 ||
+      (refresher.view != NULL && refresher.view->pendingMutations > 0)) {
+    scheduleRefresh(REFRESH_RETRY_MS);
+    return;
   }
 
+  cJSON *postFieldsJson = cJSON_CreateObject();
+  cJSON_AddStringToObject(postFieldsJson, "sync_token", refresher.syncToken);
+  cJSON *resourceTypes = cJSON_AddArrayToObject(postFieldsJson,
+                                                "resource_types");
+  cJSON_AddItemToArray(resourceTypes, cJSON_CreateString("items"));
+  cJSON_AddItemToArray(resourceTypes, cJSON_CreateString("projects"));
   char *postFields = cJSON_PrintUnformatted(postFieldsJson);
-
-  // Headers
-  char *closeTaskUrl = BASE_SYNC_URL;
-  struct curl_slist *markCompleteHeaders = NULL;
-  markCompleteHeaders =
-      curl_slist_append(markCompleteHeaders, curlArgs.headers->data);
-  markCompleteHeaders =
-      curl_slist_append(markCompleteHeaders, "Content-Type: application/json");
-  markCompleteHeaders =
-      curl_slist_append(markCompleteHeaders, "Accept: application/json");
-  struct curlArgs markCompleteArgs = {curlArgs.curl, markCompleteHeaders,
-                                      "POST", closeTaskUrl, postFields};
-
-  // Make request
-  cJSON *markCompleteJson = makeRequest(markCompleteArgs);
-  if (markCompleteJson == NULL) {
-    displayMessage("Something went wrong when making an API request to close "
-                   "the task. Press any key to return to the projects menu.");
-    return NULL;
+  cJSON_Delete(postFieldsJson);
+
+  free(refresher.body);
+  refresher.body = postFields;
+  struct curlArgs refreshCurlArgs = {.curl = refresher.curl,
+                                     .headers = refresher.headers,
+                                     .method = "POST",
+                                     .url = BASE_SYNC_URL,
+                                     .postFields = postFields};
+  if (postFields == NULL ||
+      !startJsonRequest(&refresher.request, refreshCurlArgs, NULL,
+                        &refresher.pending, REQUEST_BACKGROUND)) {
+    scheduleRefresh(refresher.interval);
+    return;
   }
+  // It can only finish once this gets back to the loop
+  refresher.request.finish = finishRefresh;
+}
 
-  // If it isn't null, the request was successfull, so we can update the
-  // menu.
-  // Free old items first
-  int tasksLength = cJSON_GetArraySize(tasksJson);
-
-  // If there's not going to be anything in the ITEM ** return anyways, don't
-  // bother doing anything. Also helps avoid an annoying bug where, when
-  // completing the last item of the list, the user will be left with random
-  // characters instead of a blank menu.
-  if (tasksLength - 1 == 0) {
-    ITEM **blankItems = (ITEM **)malloc(2 * sizeof(struct ITEM *));
-    blankItems[0] = new_item(NO_TASKS_TO_COMPLETE_MESSAGE, "");
-    blankItems[1] = (ITEM *)NULL;
-    return blankItems;
+int initRefresher(struct projectsView *projects,
+                  struct curl_slist *headers) {
+  refresher =
+      (struct refresher){.syncToken = strdup("*"), .curl = curl_easy_init()};
+  refresher.timer = -1;
+  refresher.interval = REFRESH_MS;
+  refresher.lastActivity = monotonicMs();
+  refresher.seed = (unsigned int)time(NULL) ^ (unsigned int)getpid();
+  refresher.projects = projects;
+  for (struct curl_slist *header = headers; header != NULL;
+       header = header->next) {
+    refresher.headers = curl_slist_append(refresher.headers, header->data);
   }
-
-  ITEM **taskItems = menu_items(tasksMenu);
-  for (int i = 0; i < tasksLength; i++) {
-    free_item(taskItems[i]);
-    struct taskMetaData *toFreeTMD =
-        (struct taskMetaData *)item_userptr(taskItems[i]);
-    free(toFreeTMD);
+  refresher.headers =
+      curl_slist_append(refresher.headers, "Content-Type: application/json");
+  if (refresher.syncToken == NULL || refresher.curl == NULL) {
+    return 0;
   }
 
-  // Delete completed task
-  int completedTaskIndex = item_index(currentItem);
-  cJSON_DeleteItemFromArray(tasksJson, completedTaskIndex);
-
-  // Create new items (will need to be free()-ed)
-  int newItemsLength = cJSON_GetArraySize(tasksJson);
-  ITEM **newItems =
-      createItemsFromJson(tasksJson, newItemsLength + 1, "content");
-  newItems[newItemsLength] = (ITEM *)NULL;
-
-  return newItems;
+  // The first one's a full sync, just to get a token, so it waits like any
+  // other rather than adding to startup
+  scheduleRefresh(REFRESH_MS);
+  return 1;
 }
 
-ITEM **deleteTask(cJSON *tasksJson, struct curlArgs curlArgs, MENU *curMenu) {
-  clear();
-  printw("Are you sure you want to delete this task?");
-
-  int getchChar = getch();
-  if (getchChar == 'y') {
+void freeRefresher(void) {
+  // A refresh still going when things stopped never got to finish
+  free(refresher.request.response.response);
+  cJSON_Delete(refresher.request.json);
+  curl_easy_cleanup(refresher.curl);
+  curl_slist_free_all(refresher.headers);
+  free(refresher.body);
+  free(refresher.syncToken);
+  free(refresher.viewKey);
+  memset(&refresher, 0, sizeof(refresher));
+}
 
-    struct taskMetaData *currentTaskMetaData =
-        (struct taskMetaData *)item_userptr(current_item(curMenu));
+void setRefreshView(struct taskView *view, const char *viewKey) {
+  free(refresher.viewKey);
+  refresher.viewKey = viewKey != NULL ? strdup(viewKey) : NULL;
+  // Without its key, the view can't be refreshed
+  refresher.view = refresher.viewKey != NULL ? view : NULL;
+}
 
-    if (!currentTaskMetaData) {
-      return NULL;
-    }
+void noteActivity(void) {
+  long long now = monotonicMs();
+  refresher.lastActivity = now;
 
-    char *currentItemId = currentTaskMetaData->id;
+  // Coming back to a backed off refresher brings the next one in
+  if (refresher.timer != -1 && refresher.due - now > REFRESH_MS) {
+    refresher.interval = REFRESH_MS;
+    scheduleRefresh(REFRESH_MS);
+  }
+}
 
-    if (!currentItemId) {
-      return NULL;
+// Whether key's in the view cache, and still good, without it counting as a
+// hit or a miss
+static int isViewCached(const char *key) {
+  for (struct cachedView *cached = viewCache.first; cached != NULL;
+       cached = cached->next) {
+    if (strcmp(cached->key, key) == 0) {
+      return cached->version == viewVersion(key);
     }
+  }
+  return 0;
+}
 
-    char *url =
-        combineString(BASE_REST_URL, combineString("tasks/", currentItemId));
-
-    // Assemble request args
-    struct curlArgs deleteTaskCurlArgs = {curlArgs.curl, curlArgs.headers,
-                                          "DELETE", url, curlArgs.postFields};
+// Whether a prefetch is in flight, and not just on its way out after being
+// cancelled
+static int isPrefetching(void) {
+  struct pendingRequest *request = &prefetcher.request.request;
+  return prefetcher.pending > 0 &&
+         (!atomic_load(&request->cancelled) || request->preempted);
+}
 
-    cJSON *request = makeRequest(deleteTaskCurlArgs);
+static void finishPrefetch(struct jsonRequest *request) {
+  cJSON *tasks = request->json;
+  free(request->response.response);
+  request->response.response = NULL;
+  request->json = NULL;
+
+  // Cancelled, failed, or opened some other way in the meantime
+  if (request->result != CURLE_OK || request->httpCode != 200 ||
+      tasks == NULL || isViewCached(prefetcher.viewKey)) {
+    cJSON_Delete(tasks);
+    return;
+  }
+  // Opening it sets the rest of curlArgs
+  struct curlArgs curlArgs = {.headers = prefetcher.headers, .method = "GET"};
+  struct taskView *view =
+      buildTaskView(tasks, curlArgs, prefetcher.row, prefetcher.col);
+  if (view != NULL) {
+    cacheTaskView(prefetcher.viewKey, view);
+  }
+}
 
-    if (!request) {
-      displayMessage("Error making request. Press any key to return to the "
-                     "main menu (deleteTask 2).");
-      return NULL;
-    }
+static void startPrefetch(void *data) {
+  prefetcher.timer = -1;
 
-    int toRemoveIdx = 0;
-    cJSON *task = NULL;
-    cJSON_ArrayForEach(task, tasksJson) {
-      char *curId = getJsonValue(task, "id");
-      if (strcmp(curId, currentItemId) == 0) {
-        break;
-      }
-      toRemoveIdx++;
-    }
+  // The one before is still on its way out
+  if (prefetcher.pending > 0) {
+    prefetcher.timer = addTimer(PREFETCH_DELAY_MS, startPrefetch, NULL);
+    return;
+  }
+  free(prefetcher.viewKey);
+  prefetcher.viewKey = prefetcher.wantedKey;
+  prefetcher.wantedKey = NULL;
+
+  // A GET has a handle of its own, shared with anything else that wants it
+  free(prefetcher.url);
+  prefetcher.url =
+      combineString(BASE_REST_URL "tasks/?project_id=", prefetcher.viewKey);
+  struct curlArgs curlArgs = {
+      .headers = prefetcher.headers, .method = "GET", .url = prefetcher.url};
+  if (prefetcher.url != NULL &&
+      startJsonRequest(&prefetcher.request, curlArgs, prepareTasks,
+                       &prefetcher.pending, REQUEST_PREFETCH)) {
+    // It can only finish once this gets back to the loop
+    prefetcher.request.finish = finishPrefetch;
+  }
+}
 
-    cJSON_DeleteItemFromArray(tasksJson, toRemoveIdx);
+void schedulePrefetch(struct projectsView *projectsView) {
+  cJSON *currentItemJson =
+      getCurrentItemJson(projectsView->menu, projectsView->json);
+  char *viewKey = cJSON_GetStringValue(
+      cJSON_GetObjectItemCaseSensitive(currentItemJson, "id"));
 
-    int newLength = cJSON_GetArraySize(tasksJson);
-    ITEM **newItems = createItemsFromJson(tasksJson, newLength, "content");
-    newItems[newLength] = NULL;
+  if (prefetcher.timer != -1) {
+    cancelTimer(prefetcher.timer);
+    prefetcher.timer = -1;
+  }
+  free(prefetcher.wantedKey);
+  prefetcher.wantedKey = NULL;
+
+  int fetching = isPrefetching();
+  if (fetching &&
+      (viewKey == NULL || strcmp(viewKey, prefetcher.viewKey) != 0)) {
+    cancelRequest(&prefetcher.request.request);
+    fetching = 0;
+  }
 
-    free(url);
+  // Filters are built from the task cache, and a project that's cached (or
+  // has nowhere to be cached) has no use for it
+  if (viewKey == NULL || fetching ||
+      strncmp(viewKey, FILTER_VIEW_ID_PREFIX, strlen(FILTER_VIEW_ID_PREFIX)) ==
+          0 ||
+      viewCache.budget == 0 || isViewCached(viewKey)) {
+    return;
+  }
+  prefetcher.wantedKey = strdup(viewKey);
+  if (prefetcher.wantedKey == NULL) {
+    return;
+  }
+  prefetcher.headers = projectsView->headers;
+  prefetcher.row = projectsView->row;
+  prefetcher.col = projectsView->col;
+  prefetcher.timer = addTimer(PREFETCH_DELAY_MS, startPrefetch, NULL);
+}
 
-    return newItems;
+int awaitPrefetch(const char *viewKey) {
+  if (prefetcher.timer != -1) {
+    cancelTimer(prefetcher.timer);
+    prefetcher.timer = -1;
+  }
+  free(prefetcher.wantedKey);
+  prefetcher.wantedKey = NULL;
 
-  } else {
-    return NULL;
+  if (!isPrefetching()) {
+    return 1;
   }
+  if (strcmp(viewKey, prefetcher.viewKey) != 0) {
+    cancelRequest(&prefetcher.request.request);
+    return 1;
+  }
+  // The user's waiting for it now
+  promoteRequest(&prefetcher.request.request, REQUEST_VIEW);
+  return waitForPendingOrBack(&prefetcher.pending,
+                              &prefetcher.request.request);
+}
+
+void freePrefetcher(void) {
+  free(prefetcher.request.response.response);
+  cJSON_Delete(prefetcher.request.json);
+  free(prefetcher.wantedKey);
+  free(prefetcher.viewKey);
+  free(prefetcher.url);
+  memset(&prefetcher, 0, sizeof(prefetcher));
+  prefetcher.timer = -1;
 }